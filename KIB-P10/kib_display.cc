@@ -2,7 +2,7 @@
 
 #include "led-matrix.h"
 #include "graphics.h"
-#include "transformer.h"
+#include "pixel-mapper.h"
 #include "graphics.h"
 
 #include <stdio.h>
@@ -334,10 +334,9 @@ int main(int argc, char* argv[]) {
 
   RGBMatrix *matrix = new RGBMatrix(&io, rows, chain, parallel);
 
-  // Our magic pixel re-mapping transform
-  // LinkedTransformer *transformer = new LinkedTransformer();
-  // matrix->SetTransformer(transformer);
-  // transformer->AddTransformer(new Snake8x2Transformer());
+  // Our magic pixel re-mapping; same as --led-pixel-mapper=Snake8x2
+  // matrix->ApplyPixelMapper(rgb_matrix::FindPixelMapper("Snake8x2",
+  //                                                      chain, parallel));
 
   Canvas *canvas = matrix;
 
@@ -413,11 +412,9 @@ int main(int argc, char* argv[]) {
         if (rxd.DrawBlockOK()) {
           x = x_orig + rxd.PositionX();
           y = y_orig + rxd.PositionY();
-          int x1 = x + rxd.Width();
-          int y1 = y + rxd.Height();
-	  for (int ypos = y; ypos < y1; ypos++) {
-            rgb_matrix::DrawLine(canvas, x, ypos, x1, ypos, color);
-          }
+          // Columns x .. x + Width() inclusive, as the lines drawn before.
+          rgb_matrix::FillRect(canvas, x, y, rxd.Width() + 1, rxd.Height(),
+                               color);
         } else {
           switch (rxd.TextFont()) {
             case 1:
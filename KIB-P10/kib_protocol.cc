@@ -0,0 +1,318 @@
+/* KIB_PROTOCOL.CC
+
+  Parser and renderer for the KIB serial protocol; see kib_protocol.h.
+
+*/
+
+#include "kib_protocol.h"
+
+#include <string.h>
+
+using namespace rgb_matrix;
+
+void SetKibDefaultOptions(RGBMatrix::Options *options) {
+  options->rows = 32;
+  options->cols = 32;
+  options->chain_length = 4;
+  // options->chain_length = 6;
+  options->parallel = 3;
+  options->pixel_mapper_config = "xyflipped";
+  options->multiplexing = 7;
+}
+
+/**************  FONT DECODING  ************/
+
+const char *getFontFile(int fontWide, int fontHigh) {
+
+  bool fontBold = (fontWide & 0x80) == 0x80;
+  bool fontOut = fontBold ? false : (fontWide & 0x40) == 0x40;
+  fontWide = fontWide & 0x0F;
+
+  switch(fontWide) {
+    case 4:
+      return "fonts/4x6.bdf";
+    case 5:
+      if (fontHigh < 8) return "fonts/5x7.bdf";
+      return "fonts/5x8.bdf";
+    case 6:
+      if (fontHigh < 10) return "fonts/6x9.bdf";
+      if (fontHigh < 11) return "fonts/6x10.bdf";
+      if (fontHigh < 13) return "fonts/6x12.bdf";
+      if (fontOut) return "fonts/6x13O.bdf";
+      if (fontBold) return "fonts/6x13B.bdf";
+      return "fonts/6x13.bdf";
+    case 7:
+      if (fontHigh < 14) {
+        if (fontOut) return "fonts/7x13O.bdf";
+        if (fontBold) return "fonts/7x13B.bdf";
+        return "fonts/7x13.bdf";
+      }
+      if (fontOut) return "fonts/7x14O.bdf";
+      if (fontBold) return "fonts/7x14B.bdf";
+      return "fonts/7x14.bdf";
+    case 8:
+      if (fontOut) return "fonts/8x13O.bdf";
+      if (fontBold) return "fonts/8x13B.bdf";
+      return "fonts/8x13.bdf";
+    case 9:
+      if (fontHigh < 17) {
+        if (fontBold) return "fonts/9x15B.bdf";
+        return "fonts/9x15.bdf";
+      }
+      if (fontBold) return "fonts/9x18B.bdf";
+      return "fonts/9x18.bdf";
+    case 10:
+      return "fonts/10x20.bdf";
+    case 11:
+      return "fonts/clR6x12.bdf";
+    case 12:
+      return "fonts/helvR12.bdf";
+    default:
+      return "fonts/4x6.bdf";
+  }
+}
+
+/*************  COLOR DECODING  ************/
+
+int getHue(int hue) {
+  hue &= 0x03;
+  hue *= 85;
+  return hue;
+}
+//0x15
+Color getColor(int colorId) {
+// int white = getHue(colorId >> 6);  /* for interests sake */
+  int red = getHue(colorId >> 4);
+  int green = getHue(colorId >> 2);
+  int blue = getHue(colorId);
+
+  Color color(red, green, blue);
+  return color;
+}
+
+/* COMMAND STRING PARSER MODES */
+
+  const int WAIT_START       = 0;
+  const int WAIT_COMMAND     = 1;
+  const int WAIT_INSTRUCTION = 2;
+  const int DO_END           = 3;
+  const int DO_CLEAR         = 4;
+  const int DO_REFRESH       = 5;
+  const int WAIT_TEXT        = 6;
+  const int WAIT_FONT_W      = 7;
+  const int WAIT_FONT_H      = 8;
+  const int WAIT_LINE_X      = 9;
+  const int WAIT_LINE_Y      = 10;
+  const int WAIT_POS_X       = 11;
+  const int WAIT_POS_Y       = 12;
+  const int WAIT_COLOR       = 13;
+  const int WAIT_CIRCLE_R    = 14;
+  const int WAIT_BOX_X       = 15;
+  const int WAIT_BOX_Y       = 16;
+  const int WAIT_FILL        = 17;
+  const int WAIT_PIXEL_X     = 18;
+  const int WAIT_PIXEL_Y     = 19;
+
+static int isCommand(char cmd, bool verbose) {
+  switch(cmd) {
+    case MSG_ETX:
+      if (verbose) printf("done\n");
+      return WAIT_START;
+    case CMD_NEW:     return DO_CLEAR;
+    case CMD_REFRESH: return DO_REFRESH;
+    case CMD_TEXT:    return WAIT_TEXT;
+    case CMD_FONT:    return WAIT_FONT_W;
+    case CMD_LINE:    return WAIT_LINE_X;
+    case CMD_POS:     return WAIT_POS_X;
+    case CMD_COLOR:   return WAIT_COLOR;
+    case CMD_CIRCLE:  return WAIT_CIRCLE_R;
+    case CMD_BOX:     return WAIT_BOX_X;
+    case CMD_FILL:    return WAIT_FILL;
+    case CMD_PIXEL:   return WAIT_PIXEL_X;
+  }
+  return WAIT_COMMAND;
+}
+
+/***************  PARSER  ***************/
+
+KibProtocol::KibProtocol(RGBMatrix *matrix, Canvas *pixel_canvas,
+                         bool verbose)
+  : matrix_(matrix), pixel_canvas_(pixel_canvas), verbose_(verbose),
+    offscreen_(matrix->CreateFrameCanvas()), shown_(NULL),
+    mode_(WAIT_START), txtIndex_(0), fontWide_(4), fontHigh_(5),
+    startX_(0), startY_(0), endX_(0), endY_(0), colorId_(0x10) {
+  txtBuffer_[0] = '\0';
+}
+
+KibProtocol::~KibProtocol() {
+  for (std::map<std::string, Font*>::iterator it = fonts_.begin();
+       it != fonts_.end(); ++it) {
+    delete it->second;
+  }
+}
+
+const Font &KibProtocol::LoadedFont(int fontWide, int fontHigh) {
+  const char *file = getFontFile(fontWide, fontHigh);
+  Font *&font = fonts_[file];
+  if (font == NULL) {
+    font = new Font();
+    if (!font->LoadFont(file))
+      fprintf(stderr, "Couldn't load font %s\n", file);
+  }
+  return *font;
+}
+
+char KibProtocol::Feed(char rx) {
+  switch(mode_) {
+    case WAIT_START:
+      if (rx == MSG_STX) {
+        txtIndex_ = 0;
+        txtBuffer_[0] = '\0';
+        fontWide_ = 4;
+        fontHigh_ = 5;
+        endX_ = 0;
+        endY_  = 0;
+        startX_ = 0;
+        startY_ = 0;
+        colorId_ = 0x10;
+        mode_ = WAIT_COMMAND;
+        if (verbose_) printf("parsing... ");
+      } break;
+
+    case WAIT_COMMAND:
+      if (rx == MSG_CMD) {
+        mode_ = WAIT_INSTRUCTION;
+      }
+      else mode_ = WAIT_COMMAND;
+      break;
+
+    case WAIT_INSTRUCTION:
+      mode_ = isCommand(rx, verbose_);
+      if (mode_ == DO_CLEAR) {
+        matrix_->Clear();
+        mode_ = WAIT_COMMAND;
+        return CMD_NEW;
+      }
+      if (mode_ == DO_REFRESH) {
+        shown_ = offscreen_;
+        offscreen_ = matrix_->SwapOnVSync(offscreen_);
+        mode_ = WAIT_COMMAND;
+        return CMD_REFRESH;
+      }
+      if (mode_ == WAIT_TEXT) txtIndex_ = 0;
+      break;
+
+    case WAIT_COLOR:
+      colorId_ = (int)rx;
+      mode_ = WAIT_COMMAND;
+      return CMD_COLOR;
+    case WAIT_POS_X:
+      startX_ = (int)rx;
+      mode_ = WAIT_POS_Y;
+      break;
+    case WAIT_POS_Y:
+      startY_ = (int)rx;
+      mode_ = WAIT_COMMAND;
+      return CMD_POS;
+    case WAIT_TEXT:
+      if (rx == '0') {
+        if((fontWide_ == 5) && (fontHigh_ == 8)) {
+          rx = 'O';
+        }
+      }
+      txtBuffer_[txtIndex_++] = rx;
+      if ((txtIndex_ >= MAX_TEXT_LEN) || (rx == '\0')) {
+        txtBuffer_[txtIndex_] = '\0';
+        text_cache_.DrawText(offscreen_, LoadedFont(fontWide_, fontHigh_),
+                             startX_, startY_, getColor(colorId_), NULL,
+                             txtBuffer_);
+        mode_ = WAIT_COMMAND;
+        return CMD_TEXT;
+      }
+      break;
+    case WAIT_FONT_W:
+      fontWide_ = (int)rx;
+      mode_ = WAIT_FONT_H;
+      break;
+    case WAIT_FONT_H:
+      fontHigh_ = (int)rx;
+      mode_ = WAIT_COMMAND;
+      return CMD_FONT;
+    case WAIT_LINE_X:
+      endX_ = (int)rx;
+      mode_ = WAIT_LINE_Y;
+      break;
+    case WAIT_LINE_Y:
+      endY_ = (int)rx;
+      DrawLine(offscreen_, startX_, startY_, endX_, endY_, getColor(colorId_));
+      mode_ = WAIT_COMMAND;
+      return CMD_LINE;
+    case WAIT_CIRCLE_R:
+      endX_ = (int)rx;
+      DrawCircle(offscreen_, startX_, startY_, endX_, getColor(colorId_));
+      mode_ = WAIT_COMMAND;
+      return CMD_CIRCLE;
+    case WAIT_BOX_X:
+      endX_ = (int)rx;
+      mode_ = WAIT_BOX_Y;
+      break;
+    case WAIT_BOX_Y:
+      endY_ = (int)rx;
+      //drawBox(offscreen, startX, startY, endX, endY, getColor(colorId));
+      DrawLine(offscreen_, startX_, startY_, endX_, endY_, getColor(colorId_));
+      mode_ = WAIT_COMMAND;
+      return CMD_BOX;
+    case WAIT_FILL: {
+      colorId_ = (int)rx;
+      const Color col = getColor(0x15);
+      matrix_->Fill(col.r, col.g, col.b);
+      mode_ = WAIT_COMMAND;
+      return CMD_FILL;
+    }
+    case WAIT_PIXEL_X:
+      endX_ = (int)rx;
+      mode_ = WAIT_PIXEL_Y;
+      break;
+    case WAIT_PIXEL_Y:
+      endY_ = (int)rx;
+      //drawPixel(offscreen, startX, startY, getColor(colorId));
+      pixel_canvas_->SetPixel(startX_, startY_, 200, 0, 0);
+      mode_ = WAIT_COMMAND;
+      return CMD_PIXEL;
+  }
+  return CMD_NONE;
+}
+
+/***************  SERIAL CAPTURE  ***************/
+
+KibCaptureWriter::KibCaptureWriter(FILE *out)
+  : out_(out), start_us_(GetPresentationClockMicros()) {
+  fwrite(kKibCaptureMagic, sizeof(kKibCaptureMagic), 1, out_);
+}
+
+KibCaptureWriter::~KibCaptureWriter() {
+  fclose(out_);
+}
+
+void KibCaptureWriter::Write(const char *data, uint32_t length) {
+  KibCaptureRecord record;
+  record.time_us = GetPresentationClockMicros() - start_us_;
+  record.length = length;
+  fwrite(&record, sizeof(record), 1, out_);
+  fwrite(data, 1, length, out_);
+}
+
+bool ReadKibCaptureHeader(FILE *file) {
+  char magic[sizeof(kKibCaptureMagic)];
+  return (fread(magic, sizeof(magic), 1, file) == 1
+          && memcmp(magic, kKibCaptureMagic, sizeof(magic)) == 0);
+}
+
+bool ReadKibCaptureRecord(FILE *file, KibCaptureRecord *record,
+                          char *data, uint32_t max_length) {
+  if (fread(record, sizeof(*record), 1, file) != 1)
+    return false;
+  if (record->length > max_length)
+    return false;
+  return fread(data, 1, record->length, file) == record->length;
+}
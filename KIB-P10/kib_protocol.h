@@ -0,0 +1,129 @@
+/* KIB_PROTOCOL.H
+
+  Parser and renderer for the KIB serial protocol, shared by the display
+  program kib_32x16_P10 and the kib_replay benchmark, and the file format
+  kib_32x16_P10 -s records the received serial bytes in.
+
+*/
+
+#ifndef KIB_PROTOCOL_H
+#define KIB_PROTOCOL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+#include "led-matrix.h"
+#include "graphics.h"
+#include "text-sprite-cache.h"
+
+/* MESSAGE TOKENS */
+
+  const char MSG_STX = 0xF2;
+  const char MSG_ETX = 0xF3;
+  const char MSG_CMD = 0xF4;
+
+/* COMMAND AND CONTROL CHARACTERS */
+
+  const int MAX_TEXT_LEN = 25;
+
+  const char CMD_NONE    = '\0';
+  const char CMD_BOX     = 'B';
+  const char CMD_CIRCLE  = 'R';
+  const char CMD_COLOR   = 'C';
+  const char CMD_FONT    = 'F';
+  const char CMD_FILL    = 'S';
+  const char CMD_LINE    = 'L';
+  const char CMD_NEW     = 'N';
+  const char CMD_PIXEL   = 'P';
+  const char CMD_POS     = 'X';
+  const char CMD_REFRESH = 'Z';
+  const char CMD_TEXT    = 'T';
+
+// The matrix configuration of the weighbridge display, used unless
+// overridden with --led-* flags.
+void SetKibDefaultOptions(rgb_matrix::RGBMatrix::Options *options);
+
+// The BDF file, relative to the KIB-P10 directory, for the font command.
+const char *getFontFile(int fontWide, int fontHigh);
+rgb_matrix::Color getColor(int colorId);
+
+// Turns the received bytes into drawing commands. Drawing goes to the
+// off-screen canvas; CMD_REFRESH swaps it with the one shown on the matrix.
+class KibProtocol {
+public:
+  // "pixel_canvas" receives the CMD_PIXEL dots. If "verbose", progress is
+  // printed to stdout as the serial console expects it.
+  KibProtocol(rgb_matrix::RGBMatrix *matrix, rgb_matrix::Canvas *pixel_canvas,
+              bool verbose);
+  ~KibProtocol();
+
+  // Process one received byte. Returns the command (e.g. CMD_TEXT) if this
+  // byte completed one, CMD_NONE otherwise.
+  char Feed(char rx);
+
+  // The canvas that the last CMD_REFRESH put on the matrix, or NULL.
+  rgb_matrix::FrameCanvas *shown() const { return shown_; }
+
+private:
+  KibProtocol(const KibProtocol&);  // Not copyable.
+
+  // Fonts are loaded once; the text cache knows them by their address.
+  const rgb_matrix::Font &LoadedFont(int fontWide, int fontHigh);
+
+  rgb_matrix::RGBMatrix *const matrix_;
+  rgb_matrix::Canvas *const pixel_canvas_;
+  const bool verbose_;
+  rgb_matrix::FrameCanvas *offscreen_;
+  rgb_matrix::FrameCanvas *shown_;
+  std::map<std::string, rgb_matrix::Font*> fonts_;
+  // The same labels and weights are sent again and again.
+  rgb_matrix::TextSpriteCache text_cache_;
+
+  int mode_;
+  int txtIndex_;
+  int fontWide_;
+  int fontHigh_;
+  int startX_;
+  int startY_;
+  int endX_;
+  int endY_;
+  int colorId_;
+  char txtBuffer_[MAX_TEXT_LEN + 1];
+};
+
+/* SERIAL CAPTURE FILES */
+
+// A capture starts with kKibCaptureMagic, followed by records: a
+// KibCaptureRecord and "length" bytes as they were received.
+const char kKibCaptureMagic[8] = { 'K', 'I', 'B', 'C', 'A', 'P', '0', '1' };
+
+struct KibCaptureRecord {
+  int64_t time_us;   // Since the capture started.
+  uint32_t length;
+};
+
+class KibCaptureWriter {
+public:
+  // Takes ownership of "out".
+  explicit KibCaptureWriter(FILE *out);
+  ~KibCaptureWriter();
+
+  void Write(const char *data, uint32_t length);
+
+private:
+  FILE *const out_;
+  const int64_t start_us_;
+};
+
+// Check the magic at the start of a capture file.
+bool ReadKibCaptureHeader(FILE *file);
+
+// Read one record of "file"; "data" needs room for "max_length" bytes.
+// Returns false at the end of the file or if the record is broken.
+bool ReadKibCaptureRecord(FILE *file, KibCaptureRecord *record,
+                          char *data, uint32_t max_length);
+
+#endif  // KIB_PROTOCOL_H
@@ -0,0 +1,207 @@
+/* KIB_REPLAY.CC
+
+  Feeds serial bytes recorded with "kib_32x16_P10 -s" through the same
+  parser and renderer as fast as possible, without any display hardware,
+  and reports how long the commands take. If the frames of the same run
+  were recorded with "kib_32x16_P10 -O", the frames rendered now are
+  compared with them.
+
+  Run it from the KIB-P10 directory, as the fonts are loaded from fonts/.
+
+    sudo ./kib_32x16_P10 -s /tmp/traffic.kib -O /tmp/traffic.stream
+    ./kib_replay -n 10 /tmp/traffic.kib /tmp/traffic.stream
+
+*/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "led-matrix.h"
+#include "content-streamer.h"
+
+#include "kib_protocol.h"
+
+using namespace rgb_matrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] <capture> [<recorded-frames>]\n",
+          progname);
+  fprintf(stderr, "Replays recorded KIB serial traffic without hardware and "
+          "reports the time per command.\n"
+          "If the recorded frames are given, the rendered frames are "
+          "compared with them.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-n <count>   : Replay the capture this many times. Default: 1\n"
+          "\t-O <file>    : Write the rendered frames as content stream.\n");
+  fprintf(stderr, "\nLED matrix options; need to be the same as when "
+          "recording:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static bool LoadCapture(const char *filename, std::vector<char> *bytes) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    perror(filename);
+    return false;
+  }
+  if (!ReadKibCaptureHeader(f)) {
+    fprintf(stderr, "%s: not a KIB capture\n", filename);
+    fclose(f);
+    return false;
+  }
+  char data[65536];
+  KibCaptureRecord record;
+  while (ReadKibCaptureRecord(f, &record, data, sizeof(data))) {
+    bytes->insert(bytes->end(), data, data + record.length);
+  }
+  fclose(f);
+  return true;
+}
+
+static bool SameContent(const FrameCanvas &a, const FrameCanvas &b) {
+  const char *a_data, *b_data;
+  size_t a_len, b_len;
+  a.Serialize(&a_data, &a_len);
+  b.Serialize(&b_data, &b_len);
+  return a_len == b_len && memcmp(a_data, b_data, a_len) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options led_options;
+  SetKibDefaultOptions(&led_options);
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv, &led_options, NULL)) {
+    return usage(argv[0]);
+  }
+
+  int repeat = 1;
+  const char *out_file = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:O:")) != -1) {
+    switch (opt) {
+    case 'n': repeat = atoi(optarg); break;
+    case 'O': out_file = optarg; break;
+    default: return usage(argv[0]);
+    }
+  }
+  if (optind >= argc || repeat < 1)
+    return usage(argv[0]);
+
+  std::string err;
+  if (!led_options.Validate(&err)) {
+    fprintf(stderr, "%s", err.c_str());
+    return 1;
+  }
+
+  std::vector<char> traffic;
+  if (!LoadCapture(argv[optind], &traffic))
+    return 1;
+
+  // Without GPIO, the matrix only keeps the canvases; SwapOnVSync() does
+  // not wait.
+  RGBMatrix *matrix = new RGBMatrix(NULL, led_options);
+
+  StreamIO *recorded_io = NULL;
+  StreamReader *recorded = NULL;
+  FrameCanvas *expected = NULL;
+  if (optind + 1 < argc) {
+    const int fd = open(argv[optind + 1], O_RDONLY);
+    if (fd < 0) {
+      perror(argv[optind + 1]);
+      return 1;
+    }
+    recorded_io = new MmapStreamIO(fd);
+    recorded = new StreamReader(recorded_io);
+    expected = matrix->CreateFrameCanvas();
+  }
+
+  StreamIO *out_io = NULL;
+  StreamWriter *out = NULL;
+  if (out_file) {
+    const int fd = open(out_file, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if (fd < 0) {
+      perror(out_file);
+      return 1;
+    }
+    out_io = new FileStreamIO(fd);
+    out = new StreamWriter(out_io);
+  }
+
+  // Latencies per command, in microseconds.
+  std::map<char, std::vector<double> > latencies;
+  long frames = 0, mismatches = 0, missing = 0;
+  long first_mismatch = -1;
+  const int64_t start_us = GetPresentationClockMicros();
+  for (int run = 0; run < repeat; ++run) {
+    KibProtocol protocol(matrix, matrix, false);
+    // A command's time includes the bytes leading up to it.
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (size_t i = 0; i < traffic.size(); ++i) {
+      const char command = protocol.Feed(traffic[i]);
+      if (command == CMD_NONE)
+        continue;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      latencies[command].push_back((end.tv_sec - begin.tv_sec) * 1e6
+                                   + (end.tv_nsec - begin.tv_nsec) / 1e3);
+
+      // Checks are only done on the first run and are not timed.
+      if (command == CMD_REFRESH && run == 0) {
+        if (out) out->Stream(*protocol.shown(), 0);
+        if (recorded) {
+          uint32_t hold_time_us;
+          if (!recorded->GetNext(expected, &hold_time_us)) {
+            ++missing;
+          } else if (!SameContent(*protocol.shown(), *expected)) {
+            if (first_mismatch < 0) first_mismatch = frames;
+            ++mismatches;
+          }
+        }
+        ++frames;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &begin);
+    }
+  }
+  const double total_s = (GetPresentationClockMicros() - start_us) / 1e6;
+
+  long commands = 0;
+  printf("command  count    avg(us)    p50(us)    p99(us)    max(us)\n");
+  for (std::map<char, std::vector<double> >::iterator it = latencies.begin();
+       it != latencies.end(); ++it) {
+    std::vector<double> &l = it->second;
+    std::sort(l.begin(), l.end());
+    double sum = 0;
+    for (size_t i = 0; i < l.size(); ++i) sum += l[i];
+    commands += l.size();
+    printf("   %c  %8zu %10.1f %10.1f %10.1f %10.1f\n", it->first, l.size(),
+           sum / l.size(), l[l.size() / 2], l[l.size() * 99 / 100],
+           l.back());
+  }
+  printf("%ld commands from %zu bytes x %d in %.3fs: %.0f commands/s\n",
+         commands, traffic.size(), repeat, total_s, commands / total_s);
+
+  int exit_code = 0;
+  if (recorded) {
+    if (recorded->GetNext(expected, NULL)) ++missing;  // Recorded more.
+    printf("%ld frames compared: %ld differ", frames, mismatches);
+    if (first_mismatch >= 0) printf(" (first: frame %ld)", first_mismatch);
+    if (missing) printf(", %ld missing in either", missing);
+    printf("\n");
+    exit_code = (mismatches || missing) ? 2 : 0;
+  }
+
+  delete out;
+  delete out_io;
+  delete recorded;
+  delete recorded_io;
+  delete matrix;
+  return exit_code;
+}
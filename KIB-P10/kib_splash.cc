@@ -0,0 +1,287 @@
+/* KIB_SPLASH.CC
+
+  Renders the splash screen into a content stream file; see kib_splash.h.
+
+*/
+
+#include "kib_splash.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "content-streamer.h"
+
+using namespace rgb_matrix;
+
+// The hold time of the single frame of an image that doesn't scroll. The
+// player repeats it as long as the splash lasts.
+static const uint32_t kStillHoldUs = 1000 * 1000;
+
+/***************  PPM IMAGE  ***************/
+
+struct SplashImage {
+  int width;
+  int height;
+  std::vector<uint8_t> rgb;  // width * height pixels, R, G, B each.
+};
+
+// Reads a header number, skipping whitespace and comments before it.
+static bool ReadPPMNumber(FILE *f, int *value) {
+  int c = fgetc(f);
+  while (c == '#' || isspace(c)) {
+    if (c == '#') {
+      while (c != '\n' && c != EOF) c = fgetc(f);
+    }
+    c = fgetc(f);
+  }
+  if (!isdigit(c)) return false;
+  *value = 0;
+  while (isdigit(c)) {
+    if (*value > 100000) return false;
+    *value = *value * 10 + (c - '0');
+    c = fgetc(f);
+  }
+  // Exactly one whitespace separates the header from the pixels.
+  return c != EOF && isspace(c);
+}
+
+// Binary PPM (P6) with any maxval; colors are scaled to 0..255.
+static bool LoadPPM(const char *filename, SplashImage *image) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    perror(filename);
+    return false;
+  }
+  int maxval = 0;
+  const bool header_ok = (fgetc(f) == 'P' && fgetc(f) == '6'
+                          && ReadPPMNumber(f, &image->width)
+                          && ReadPPMNumber(f, &image->height)
+                          && ReadPPMNumber(f, &maxval)
+                          && image->width > 0 && image->height > 0
+                          && maxval > 0 && maxval < 65536);
+  if (!header_ok) {
+    fprintf(stderr, "%s: not a binary PPM (P6) image\n", filename);
+    fclose(f);
+    return false;
+  }
+  // Samples are one byte up to maxval 255, two bytes (MSB first) above.
+  const int sample_bytes = maxval < 256 ? 1 : 2;
+  const size_t samples = (size_t)image->width * image->height * 3;
+  std::vector<uint8_t> raw(samples * sample_bytes);
+  const bool complete = fread(&raw[0], 1, raw.size(), f) == raw.size();
+  fclose(f);
+  if (!complete) {
+    fprintf(stderr, "%s: image data is cut short\n", filename);
+    return false;
+  }
+  image->rgb.resize(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    const int sample = (sample_bytes == 1
+                        ? raw[i]
+                        : (raw[2 * i] << 8) | raw[2 * i + 1]);
+    image->rgb[i] = (sample >= maxval) ? 255 : sample * 255 / maxval;
+  }
+  fprintf(stderr, "Read image '%s' with %dx%d\n", filename,
+          image->width, image->height);
+  return true;
+}
+
+/***************  STREAM CACHE  ***************/
+
+static const char kStreamPrefix[] = "kib-splash-";
+static const char kStreamSuffix[] = ".stream";
+
+// The cache directory is created if needed, and only used if nobody else
+// can have put or changed files in it: a real directory, not a symlink,
+// owned by us and not accessible by anyone else.
+static bool PrepareCacheDir(const char *cache_dir) {
+  if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST) {
+    perror(cache_dir);
+    return false;
+  }
+  struct stat dir_stat;
+  if (lstat(cache_dir, &dir_stat) != 0) {
+    perror(cache_dir);
+    return false;
+  }
+  if (!S_ISDIR(dir_stat.st_mode) || dir_stat.st_uid != geteuid()
+      || (dir_stat.st_mode & 077) != 0) {
+    fprintf(stderr, "%s: not a private directory of this user\n", cache_dir);
+    return false;
+  }
+  return true;
+}
+
+// Streams of other images or settings are not used anymore; each is some
+// ten megabytes.
+static void RemoveStaleStreams(const char *cache_dir,
+                               const std::string &stream_file) {
+  DIR *dir = opendir(cache_dir);
+  if (dir == NULL) return;
+  const size_t prefix_len = strlen(kStreamPrefix);
+  const size_t suffix_len = strlen(kStreamSuffix);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const size_t len = strlen(entry->d_name);
+    if (len < prefix_len + suffix_len
+        || strncmp(entry->d_name, kStreamPrefix, prefix_len) != 0
+        || strcmp(entry->d_name + len - suffix_len, kStreamSuffix) != 0)
+      continue;
+    const std::string file = std::string(cache_dir) + "/" + entry->d_name;
+    if (file != stream_file) unlink(file.c_str());
+  }
+  closedir(dir);
+}
+
+static void AppendKey(std::string *key, const char *name, long long value) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%s=%lld;", name, value);
+  key->append(buffer);
+}
+
+static void AppendKey(std::string *key, const char *name, const char *value) {
+  key->append(name).append("=").append(value ? value : "").append(";");
+}
+
+// The file name depends on everything that goes into the frames: the image
+// file (by name, identity and modification time) and the matrix settings
+// that change the content of a FrameCanvas.
+static std::string SplashStreamFile(RGBMatrix *matrix,
+                                    const RGBMatrix::Options &options,
+                                    const char *image_file,
+                                    const struct stat &image_stat,
+                                    int scroll_ms, const char *cache_dir) {
+  std::string key = "kib-splash-1;";
+  AppendKey(&key, "image", image_file);
+  AppendKey(&key, "dev", image_stat.st_dev);
+  AppendKey(&key, "ino", image_stat.st_ino);
+  AppendKey(&key, "size", image_stat.st_size);
+  AppendKey(&key, "mtime", image_stat.st_mtime);
+  AppendKey(&key, "scroll_ms", scroll_ms > 0 ? scroll_ms : 0);
+  AppendKey(&key, "width", matrix->width());
+  AppendKey(&key, "height", matrix->height());
+  AppendKey(&key, "luminance", matrix->luminance_correct());
+  AppendKey(&key, "hardware", options.hardware_mapping);
+  AppendKey(&key, "rows", options.rows);
+  AppendKey(&key, "cols", options.cols);
+  AppendKey(&key, "chain", options.chain_length);
+  AppendKey(&key, "parallel", options.parallel);
+  AppendKey(&key, "pwm_bits", options.pwm_bits);
+  AppendKey(&key, "brightness", options.brightness);
+  AppendKey(&key, "row_addr", options.row_address_type);
+  AppendKey(&key, "multiplexing", options.multiplexing);
+  AppendKey(&key, "inverse", options.inverse_colors);
+  AppendKey(&key, "rgb", options.led_rgb_sequence);
+  AppendKey(&key, "mapper", options.pixel_mapper_config);
+
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (size_t i = 0; i < key.size(); ++i) {
+    hash = (hash ^ (uint8_t)key[i]) * 0x100000001b3ULL;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "/%s%016llx%s",
+           kStreamPrefix, (unsigned long long)hash, kStreamSuffix);
+  return std::string(cache_dir) + name;
+}
+
+// One frame for each pixel the image scrolls to the left, until it is back
+// at the start. Returns the number of frames, 0 if writing failed.
+static int WriteSplashFrames(RGBMatrix *matrix, const SplashImage &image,
+                             int scroll_ms, StreamIO *io) {
+  StreamWriter *writer = new StreamWriter(io);
+  FrameCanvas *canvas = matrix->CreateFrameCanvas();
+  const int frames = scroll_ms > 0 ? image.width : 1;
+  const uint32_t hold_us = scroll_ms > 0 ? scroll_ms * 1000 : kStillHoldUs;
+  bool success = true;
+  for (int position = 0; position < frames && success; ++position) {
+    canvas->Clear();
+    for (int y = 0; y < canvas->height() && y < image.height; ++y) {
+      const uint8_t *const row = &image.rgb[3 * y * image.width];
+      for (int x = 0; x < canvas->width(); ++x) {
+        const uint8_t *const p = row + 3 * ((position + x) % image.width);
+        canvas->SetPixel(x, y, p[0], p[1], p[2]);
+      }
+    }
+    success = writer->Stream(*canvas, hold_us);
+  }
+  delete writer;  // Writes the index.
+  return success ? frames : 0;
+}
+
+static bool RenderSplashFile(RGBMatrix *matrix, const SplashImage &image,
+                             int scroll_ms, const std::string &stream_file) {
+  // A new file of our own, even if something is there by that name.
+  const std::string name_template = stream_file + ".XXXXXX";
+  std::vector<char> temp_name(name_template.c_str(),
+                              name_template.c_str() + name_template.size() + 1);
+  const int fd = mkstemp(&temp_name[0]);
+  if (fd < 0) {
+    perror(name_template.c_str());
+    return false;
+  }
+  const std::string temp_file = &temp_name[0];
+  FileStreamIO *io = new FileStreamIO(fd);
+  const int frames = WriteSplashFrames(matrix, image, scroll_ms, io);
+  delete io;
+
+  // Only a complete stream gets the name it is looked up by.
+  if (frames == 0 || rename(temp_file.c_str(), stream_file.c_str()) != 0) {
+    fprintf(stderr, "Can't write splash stream %s\n", stream_file.c_str());
+    unlink(temp_file.c_str());
+    return false;
+  }
+  fprintf(stderr, "Rendered %d splash frames to %s\n", frames,
+          stream_file.c_str());
+  return true;
+}
+
+StreamIO *OpenSplashStream(RGBMatrix *matrix,
+                           const RGBMatrix::Options &options,
+                           const char *image_file, int scroll_ms,
+                           const char *cache_dir) {
+  struct stat image_stat;
+  if (stat(image_file, &image_stat) != 0) {
+    perror(image_file);
+    return NULL;
+  }
+  SplashImage image;
+  bool image_loaded = false;
+  if (PrepareCacheDir(cache_dir)) {
+    const std::string stream_file = SplashStreamFile(
+      matrix, options, image_file, image_stat, scroll_ms, cache_dir);
+    struct stat stream_stat;
+    const bool cached = (lstat(stream_file.c_str(), &stream_stat) == 0
+                         && S_ISREG(stream_stat.st_mode)
+                         && stream_stat.st_uid == geteuid());
+    if (!cached) {
+      if (!LoadPPM(image_file, &image)) return NULL;
+      image_loaded = true;
+      if (RenderSplashFile(matrix, image, scroll_ms, stream_file))
+        RemoveStaleStreams(cache_dir, stream_file);
+    }
+    const int fd = open(stream_file.c_str(), O_RDONLY);
+    if (fd >= 0) return new MmapStreamIO(fd);
+  }
+
+  // The splash still works without the cache, only it takes the time to
+  // render and the memory for it at each start.
+  fprintf(stderr, "Can't use the splash cache in %s; rendering to memory\n",
+          cache_dir);
+  if (!image_loaded && !LoadPPM(image_file, &image)) return NULL;
+  StreamIO *io = new MemStreamIO();
+  if (WriteSplashFrames(matrix, image, scroll_ms, io) == 0) {
+    delete io;
+    return NULL;
+  }
+  return io;
+}
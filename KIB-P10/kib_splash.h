@@ -0,0 +1,33 @@
+/* KIB_SPLASH.H
+
+  The splash screen kib_32x16_P10 shows at startup: a PPM image scrolling
+  across the display. It is rendered once into a content stream file, which
+  is kept for the next start with the same image and matrix settings, and
+  played from there with rgb_matrix::StreamPlayer.
+
+*/
+
+#ifndef KIB_SPLASH_H
+#define KIB_SPLASH_H
+
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+class StreamIO;
+}
+
+// Where splash streams are kept. Created with mode 0700 by the user the
+// matrix dropped privileges to, and only used if it is private to it.
+const char kSplashCacheDir[] = "/var/tmp/kib-splash";
+
+// The stream for "image_file" scrolling by one pixel every "scroll_ms"
+// milliseconds (not at all if <= 0) on "matrix", created with "options".
+// Comes from "cache_dir", rendered there first unless it is there from an
+// earlier start; the streams for other images or settings are then removed.
+// If the cache can't be used, the stream is rendered into memory.
+// Returns NULL and prints why if the image can't be used.
+rgb_matrix::StreamIO *OpenSplashStream(
+  rgb_matrix::RGBMatrix *matrix, const rgb_matrix::RGBMatrix::Options &options,
+  const char *image_file, int scroll_ms, const char *cache_dir);
+
+#endif  // KIB_SPLASH_H
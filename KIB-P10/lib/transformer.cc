@@ -31,83 +31,6 @@
 
 namespace rgb_matrix {
 	
-////////////////////////////////
-
-/********************************/
-/* Snake 8x2 Transformer Canvas */
-/********************************/
-class Snake8x2Transformer::TransformCanvas : public Canvas {
-public:
-  TransformCanvas() : delegatee_(NULL) {}
-
-  void SetDelegatee(Canvas* delegatee);
-
-  virtual void Clear();
-  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
-  virtual int width() const;
-  virtual int height() const;
-  virtual void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
-
-private:
-  Canvas *delegatee_;
-};
-
-void Snake8x2Transformer::TransformCanvas::SetDelegatee(Canvas* delegatee) {
-  delegatee_ = delegatee;
-}
-
-void Snake8x2Transformer::TransformCanvas::Clear() {
-  delegatee_->Clear();
-}
-
-void Snake8x2Transformer::TransformCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
-  delegatee_->Fill(red, green, blue);
-}
-
-int Snake8x2Transformer::TransformCanvas::width() const {
-  return delegatee_->width() / 2;
-}
-
-int Snake8x2Transformer::TransformCanvas::height() const {
-  return delegatee_->height() * 2;
-}
-
-void Snake8x2Transformer::TransformCanvas::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
-  int new_x;
-  int new_y;
-
-  new_x = ((x / 8) * 16) + (x % 8);
-  if ((y & 4) == 0) {	
-    new_x += 8;
-  }
-
-  new_y = ((y / 8) * 4) + (y % 4);
-
-  delegatee_->SetPixel(new_x, new_y, red, green, blue);
-}
-
-
-/*************************/
-/* Snake 8x2 Transformer */
-/*************************/
-Snake8x2Transformer::Snake8x2Transformer()
-  : canvas_(new TransformCanvas()) {
-}
-
-Snake8x2Transformer::~Snake8x2Transformer() {
-  delete canvas_;
-}
-
-Canvas *Snake8x2Transformer::Transform(Canvas *output) {
-  assert(output != NULL);
-
-  canvas_->SetDelegatee(output);
-  return canvas_;
-}
-
-////////////////////////////////	
-	
-
 /*****************************/
 /* Rotate Transformer Canvas */
 /*****************************/
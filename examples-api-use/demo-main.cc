@@ -88,27 +88,23 @@ public:
   BrightnessPulseGenerator(RGBMatrix *m)
     : ThreadedCanvasManipulator(m), matrix_(m) {}
   void Run() {
-    const uint8_t max_brightness = matrix_->brightness();
     const uint8_t c = 255;
     uint8_t count = 0;
 
     while (running() && !interrupt_received) {
-      if (matrix_->brightness() < 1) {
-        matrix_->SetBrightness(max_brightness);
-        count++;
-      } else {
-        matrix_->SetBrightness(matrix_->brightness() - 1);
-      }
-
-      switch (count % 4) {
+      switch (count++ % 4) {
       case 0: matrix_->Fill(c, 0, 0); break;
       case 1: matrix_->Fill(0, c, 0); break;
       case 2: matrix_->Fill(0, 0, c); break;
       case 3: matrix_->Fill(c, c, c); break;
       }
 
-      usleep(20 * 1000);
+      // The refresh fades out; the pixels stay as they are.
+      matrix_->SetOutputBrightness(100);
+      matrix_->SetOutputBrightness(1, 2000);
+      usleep(2000 * 1000);
     }
+    matrix_->SetOutputBrightness(100);
   }
 
 private:
@@ -256,7 +252,8 @@ public:
     : ThreadedCanvasManipulator(m), scroll_jumps_(scroll_jumps),
       scroll_ms_(scroll_ms),
       horizontal_position_(0),
-      matrix_(m) {
+      matrix_(m), scroll_canvas_(NULL), back_scroll_canvas_(NULL),
+      can_scroll_canvas_(true) {
     offscreen_ = matrix_->CreateFrameCanvas();
   }
 
@@ -315,18 +312,35 @@ public:
     const int screen_height = offscreen_->height();
     const int screen_width = offscreen_->width();
     while (running() && !interrupt_received) {
+      bool image_changed = false;
       {
         MutexLock l(&mutex_new_image_);
         if (new_image_.IsValid()) {
           current_image_.Delete();
           current_image_ = new_image_;
           new_image_.Reset();
+          image_changed = true;
         }
       }
       if (!current_image_.IsValid()) {
         usleep(100 * 1000);
         continue;
       }
+      if (image_changed && scroll_ms_ > 0) {
+        PrepareScrollCanvas(screen_width, screen_height);
+      }
+      if (scroll_canvas_ && scroll_ms_ > 0) {
+        // The image is on the canvas already, only the window moves.
+        scroll_canvas_->SetScrollOffset(horizontal_position_
+                                        % current_image_.width);
+        FrameCanvas *previous = matrix_->SwapOnVSync(scroll_canvas_);
+        if (previous != scroll_canvas_ && previous != back_scroll_canvas_)
+          offscreen_ = previous;
+        horizontal_position_ += scroll_jumps_;
+        if (horizontal_position_ < 0) horizontal_position_ = current_image_.width;
+        usleep(scroll_ms_ * 1000);
+        continue;
+      }
       for (int x = 0; x < screen_width; ++x) {
         for (int y = 0; y < screen_height; ++y) {
           const Pixel &p = current_image_.getPixel(
@@ -346,6 +360,34 @@ public:
     }
   }
 
+private:
+  // Draw the image once onto a canvas wider than the screen, followed by
+  // its beginning again, so that every scroll position is a window of it.
+  // Without support for that in this matrix configuration, the image is
+  // drawn for each step instead.
+  // The canvas on the screen is left alone; the new image goes onto the
+  // other one, which is swapped in at the next step.
+  void PrepareScrollCanvas(int screen_width, int screen_height) {
+    const int width = current_image_.width + screen_width;
+    FrameCanvas *canvas = back_scroll_canvas_;
+    if (canvas == NULL || canvas->width() != width) {
+      canvas = can_scroll_canvas_ ? matrix_->CreateScrollCanvas(width) : NULL;
+      can_scroll_canvas_ = (canvas != NULL);
+      if (canvas == NULL) {
+        scroll_canvas_ = back_scroll_canvas_ = NULL;
+        return;
+      }
+    }
+    for (int x = 0; x < width; ++x) {
+      for (int y = 0; y < screen_height; ++y) {
+        const Pixel &p = current_image_.getPixel(x % current_image_.width, y);
+        canvas->SetPixel(x, y, p.red, p.green, p.blue);
+      }
+    }
+    back_scroll_canvas_ = scroll_canvas_;
+    scroll_canvas_ = canvas;
+  }
+
 private:
   struct Pixel {
     Pixel() : red(0), green(0), blue(0){}
@@ -394,6 +436,9 @@ private:
 
   RGBMatrix* matrix_;
   FrameCanvas* offscreen_;
+  FrameCanvas* scroll_canvas_;  // Current image, if scrolling it by offset.
+  FrameCanvas* back_scroll_canvas_;  // Previous image; next one goes here.
+  bool can_scroll_canvas_;
 };
 
 
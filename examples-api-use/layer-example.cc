@@ -0,0 +1,103 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// A weight reading over a background and a translucent band, each in its
+// own layer of a LayerCompositor. The background is drawn once; for each
+// new reading only the text layer is drawn, and only where the text was or
+// is gets blended onto the frame again.
+//
+// This code is public domain
+// (but note, that the led-matrix library this depends on is GPL v2)
+
+#include "led-matrix.h"
+#include "graphics.h"
+#include "layer-compositor.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::Layer;
+using rgb_matrix::LayerCompositor;
+using rgb_matrix::RGBMatrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-f <font-file>    : Use given font. "
+          "Default: ../fonts/7x13.bdf\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options defaults;
+  defaults.rows = 32;
+  RGBMatrix *matrix = rgb_matrix::CreateMatrixFromFlags(&argc, &argv,
+                                                        &defaults);
+  if (matrix == NULL)
+    return 1;
+
+  const char *bdf_font_file = "../fonts/7x13.bdf";
+  int opt;
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    switch (opt) {
+    case 'f': bdf_font_file = optarg; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  rgb_matrix::Font font;
+  if (!font.LoadFont(bdf_font_file)) {
+    fprintf(stderr, "Couldn't load font '%s'\n", bdf_font_file);
+    return 1;
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  const int width = matrix->width();
+  const int height = matrix->height();
+  LayerCompositor layers(width, height, 3);
+
+  // Layer 0: a gradient from green to blue.
+  Layer *const background = layers.layer(0);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      background->SetPixel(x, y, 0, 255 * (width - x) / width,
+                           255 * x / width);
+    }
+  }
+
+  // Layer 1: a dark band that lets half of the background through.
+  const int band_y = (height - font.height()) / 2 - 1;
+  Layer *const band = layers.layer(1);
+  for (int y = band_y; y < band_y + font.height() + 2; ++y) {
+    for (int x = 0; x < width; ++x) {
+      band->SetPixelAlpha(x, y, 0, 0, 0, 128);
+    }
+  }
+
+  // Layer 2: the reading, drawn again for each new value.
+  Layer *const reading = layers.layer(2);
+  const rgb_matrix::Color white(255, 255, 255);
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  for (int weight = 0; !interrupt_received; weight = (weight + 20) % 60000) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d kg", weight);
+    reading->Clear();
+    rgb_matrix::DrawText(reading, font, 1, band_y + 1 + font.baseline(),
+                         white, NULL, text);
+    layers.Compose(offscreen);
+    offscreen = matrix->SwapOnVSync(offscreen);
+    usleep(100 * 1000);
+  }
+
+  matrix->Clear();
+  delete matrix;
+  return 0;
+}
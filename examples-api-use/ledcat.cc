@@ -1,83 +1,242 @@
 // -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
-// A program that reads frames form STDIN as RGB24, much like
+// A program that reads raw frames from STDIN, much like
 // https://github.com/polyfloyd/ledcat does.
 //
+// Frames are width * height pixels, row by row, in one of these formats
+// (named like the ffmpeg -pix_fmt that produces them):
+//   rgb24    : 3 bytes per pixel (default).
+//   rgb565le : 2 bytes per pixel, little endian. Less to push through a pipe.
+//   gray     : 1 byte per pixel.
+//
+// For example, for a 64x32 panel:
+//   ffmpeg -i video.mp4 -vf scale=64:32 -pix_fmt rgb565le -f rawvideo - |
+//     sudo ./ledcat -f rgb565le --led-cols=64
+//
 // This code is public domain
 // (but note, that the led-matrix library this depends on is GPL v2)
 
 #include "led-matrix.h"
 
-#include <math.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define FPS 60
+#include <vector>
 
-using rgb_matrix::GPIO;
+using rgb_matrix::FrameCanvas;
 using rgb_matrix::RGBMatrix;
-using rgb_matrix::Canvas;
 
 volatile bool interrupt_received = false;
 static void InterruptHandler(int signo) {
   interrupt_received = true;
 }
 
-int main(int argc, char *argv[]) {
-  RGBMatrix::Options defaults;
-  defaults.hardware_mapping = "regular"; // or e.g. "adafruit-hat"
-  defaults.rows = 32;
-  defaults.chain_length = 1;
-  defaults.parallel = 1;
-  Canvas *canvas = rgb_matrix::CreateMatrixFromFlags(&argc, &argv, &defaults);
-  if (canvas == NULL) {
-    return 1;
+enum PixelFormat { RGB24, RGB565LE, GRAY };
+
+static int BytesPerPixel(PixelFormat format) {
+  switch (format) {
+  case RGB24:    return 3;
+  case RGB565LE: return 2;
+  case GRAY:     return 1;
   }
+  return 3;
+}
 
-  // It is always good to set up a signal handler to cleanly exit when we
-  // receive a CTRL-C for instance. The DrawOnCanvas() routine is looking
-  // for that.
-  signal(SIGTERM, InterruptHandler);
-  signal(SIGINT, InterruptHandler);
+// Frames come either directly from a memory mapped file, or are read from a
+// pipe into a buffer.
+class FrameSource {
+public:
+  FrameSource(int fd, size_t frame_size)
+    : fd_(fd), frame_size_(frame_size), map_(NULL), map_size_(0),
+      map_pos_(0), buffer_(frame_size) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (m != MAP_FAILED) {
+        map_ = (const uint8_t*) m;
+        map_size_ = st.st_size;
+        madvise(m, map_size_, MADV_SEQUENTIAL);
+      }
+    }
+#ifdef F_SETPIPE_SZ
+    // A pipe buffer of a few frames lets the producer write a whole frame
+    // while we are busy, instead of us waking up for every 64k.
+    if (map_ == NULL) fcntl(fd, F_SETPIPE_SZ, 4 * frame_size);
+#endif
+  }
+  ~FrameSource() {
+    if (map_) munmap((void*) map_, map_size_);
+  }
 
-  ssize_t frame_size = canvas->width() * canvas->height() * 3;
-  uint8_t buf[frame_size];
+  // Returns the next frame or NULL at the end of the input. Valid until
+  // the next call.
+  const uint8_t *Next() {
+    if (map_) {
+      if (map_pos_ + frame_size_ > map_size_) return NULL;
+      const uint8_t *frame = map_ + map_pos_;
+      map_pos_ += frame_size_;
+      return frame;
+    }
+    size_t total = 0;
+    while (total < frame_size_) {
+      const ssize_t r = read(fd_, &buffer_[total], frame_size_ - total);
+      if (r <= 0 || interrupt_received) return NULL;
+      total += r;
+    }
+    return &buffer_[0];
+  }
 
-  while (1) {
-    struct timespec start;
-    timespec_get(&start, TIME_UTC);
+private:
+  const int fd_;
+  const size_t frame_size_;
+  const uint8_t *map_;
+  size_t map_size_;
+  size_t map_pos_;
+  std::vector<uint8_t> buffer_;
+};
 
-    ssize_t nread;
-    ssize_t total_nread = 0;
-    while ((nread = read(STDIN_FILENO, &buf[total_nread], frame_size - total_nread)) > 0) {
-      if (interrupt_received) {
-        return 1;
+// Copy the frame to the canvas. RGB24 goes there directly; the other
+// formats are expanded one row at a time.
+static void FrameToCanvas(const uint8_t *frame, PixelFormat format,
+                          std::vector<uint8_t> *row_buffer,
+                          FrameCanvas *canvas) {
+  const int width = canvas->width();
+  const int height = canvas->height();
+  if (format == RGB24) {
+    canvas->SetPixels(0, 0, width, height, frame, 3 * width);
+    return;
+  }
+  uint8_t *const rgb = &(*row_buffer)[0];
+  for (int y = 0; y < height; ++y) {
+    uint8_t *out = rgb;
+    if (format == RGB565LE) {
+      for (int x = 0; x < width; ++x, frame += 2) {
+        const uint16_t v = frame[0] | (frame[1] << 8);
+        const uint8_t r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+        *out++ = (r << 3) | (r >> 2);
+        *out++ = (g << 2) | (g >> 4);
+        *out++ = (b << 3) | (b >> 2);
+      }
+    } else {
+      for (int x = 0; x < width; ++x, ++frame) {
+        *out++ = *frame;
+        *out++ = *frame;
+        *out++ = *frame;
       }
-      total_nread += nread;
-    }
-    if (total_nread < frame_size){
-      break;
     }
+    canvas->SetPixels(0, y, width, 1, rgb, 3 * width);
+  }
+}
 
-    for (int y = 0; y < canvas->height(); y++) {
-      for (int x = 0; x < canvas->width(); x++) {
-        uint8_t *p = &buf[(y * canvas->width() + x) * 3];
-        uint8_t r = *(p+0), g = *(p+1), b = *(p+2);
-        canvas->SetPixel(x, y, r, g, b);
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] < frames\n", progname);
+  fprintf(stderr, "Reads raw frames of the size of the display from stdin.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-f <format>     : Pixel format: rgb24 (default), rgb565le, "
+          "gray.\n"
+          "\t-F <fps>        : Frames per second at most. Default 60; "
+          "0: show frames\n"
+          "\t                  as fast as they come in.\n"
+          "\t-v              : Print frames/second at the end.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  matrix_options.hardware_mapping = "regular"; // or e.g. "adafruit-hat"
+  matrix_options.rows = 32;
+  matrix_options.chain_length = 1;
+  matrix_options.parallel = 1;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  PixelFormat format = RGB24;
+  int fps = 60;
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:F:v")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (strcmp(optarg, "rgb24") == 0) format = RGB24;
+      else if (strcmp(optarg, "rgb565le") == 0) format = RGB565LE;
+      else if (strcmp(optarg, "gray") == 0) format = GRAY;
+      else {
+        fprintf(stderr, "Unknown pixel format '%s'\n", optarg);
+        return usage(argv[0]);
       }
+      break;
+    case 'F':
+      fps = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      return usage(argv[0]);
     }
+  }
+  if (isatty(STDIN_FILENO)) {
+    fprintf(stderr, "Expecting frames on stdin.\n");
+    return usage(argv[0]);
+  }
 
-    struct timespec end;
-    timespec_get(&end, TIME_UTC);
-    long tudiff = (end.tv_nsec / 1000 + end.tv_sec * 1000000) - (start.tv_nsec / 1000 + start.tv_sec * 1000000);
-    if (tudiff < 1000000l / FPS) {
-      usleep(1000000l / FPS - tudiff);
-    }
+  RGBMatrix *matrix = rgb_matrix::CreateMatrixFromOptions(matrix_options,
+                                                          runtime_opt);
+  if (matrix == NULL) {
+    return 1;
+  }
+
+  // It is always good to set up a signal handler to cleanly exit when we
+  // receive a CTRL-C for instance.
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  const int width = offscreen->width();
+  const int height = offscreen->height();
+  FrameSource source(STDIN_FILENO, width * height * BytesPerPixel(format));
+  std::vector<uint8_t> row_buffer(3 * width);
+
+  const int64_t frame_us = fps > 0 ? 1000000 / fps : 0;
+  const int64_t start_us = rgb_matrix::GetPresentationClockMicros();
+  int64_t show_at_us = start_us - frame_us;
+  long frame_count = 0;
+  const uint8_t *frame = source.Next();
+  while (!interrupt_received && frame != NULL) {
+    FrameToCanvas(frame, format, &row_buffer, offscreen);
+    // Not earlier than one frame time after the previous one, but don't
+    // try to catch up if the input was late.
+    const int64_t now_us = rgb_matrix::GetPresentationClockMicros();
+    show_at_us = (show_at_us + frame_us > now_us) ? show_at_us + frame_us
+      : now_us;
+    matrix->PresentAt(offscreen, show_at_us);
+    ++frame_count;
+    frame = source.Next();  // While the refresh thread switches to it.
+    offscreen = matrix->AwaitRetiredCanvas(NULL);
+  }
+
+  if (verbose) {
+    const int64_t duration_us =
+      rgb_matrix::GetPresentationClockMicros() - start_us;
+    fprintf(stderr, "%ld frames in %.3fs: %.1f frames/s\n", frame_count,
+            duration_us / 1e6,
+            duration_us > 0 ? frame_count * 1e6 / duration_us : 0.0);
   }
 
   // Animation finished. Shut down the RGB matrix.
-  canvas->Clear();
-  delete canvas;
+  matrix->Clear();
+  delete matrix;
   return 0;
 }
@@ -0,0 +1,81 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// A traffic light as at the entry of a weighbridge, drawn once into a
+// PaletteCanvas. Switching between stop and go only changes two palette
+// entries; nothing is drawn again.
+//
+// This code is public domain
+// (but note, that the led-matrix library this depends on is GPL v2)
+
+#include "led-matrix.h"
+#include "palette-canvas.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <signal.h>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::PaletteCanvas;
+using rgb_matrix::RGBMatrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+// Palette indexes.
+static const uint8_t kBlack = 0;
+static const uint8_t kHousing = 1;
+static const uint8_t kRedLamp = 2;
+static const uint8_t kGreenLamp = 3;
+
+static void DrawLamp(PaletteCanvas *canvas, int x, int y, int radius,
+                     uint8_t index) {
+  for (int dy = -radius; dy <= radius; ++dy) {
+    for (int dx = -radius; dx <= radius; ++dx) {
+      if (dx * dx + dy * dy <= radius * radius)
+        canvas->SetIndex(x + dx, y + dy, index);
+    }
+  }
+}
+
+static void SetLights(PaletteCanvas *canvas, bool go) {
+  canvas->SetPaletteColor(kRedLamp, go ? 40 : 255, 0, 0);
+  canvas->SetPaletteColor(kGreenLamp, 0, go ? 255 : 40, 0);
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options defaults;
+  defaults.rows = 32;
+  RGBMatrix *matrix = rgb_matrix::CreateMatrixFromFlags(&argc, &argv,
+                                                        &defaults);
+  if (matrix == NULL)
+    return 1;
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  const int width = matrix->width();
+  const int height = matrix->height();
+  PaletteCanvas light(width, height);
+  light.SetPaletteColor(kBlack, 0, 0, 0);
+  light.SetPaletteColor(kHousing, 60, 60, 60);
+
+  // Two lamps stacked in a housing, as big as fits.
+  const int radius = (height / 2 - 2) / 2;
+  const int x = width / 2;
+  light.FillRect(x - radius - 1, 0, 2 * radius + 3, height, 60, 60, 60);
+  DrawLamp(&light, x, height / 4, radius, kRedLamp);
+  DrawLamp(&light, x, height * 3 / 4, radius, kGreenLamp);
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  for (bool go = false; !interrupt_received; go = !go) {
+    SetLights(&light, go);
+    light.CopyTo(offscreen);
+    offscreen = matrix->SwapOnVSync(offscreen);
+    sleep(3);
+  }
+
+  matrix->Clear();
+  delete matrix;
+  return 0;
+}
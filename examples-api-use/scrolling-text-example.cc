@@ -55,6 +55,23 @@ static bool FullSaturation(const Color &c) {
     && (c.b == 0 || c.b == 255);
 }
 
+// Draw the text at "x", with "y" being the baseline.
+static void DrawScrollText(Canvas *canvas, int x, int y,
+                           const rgb_matrix::Font *outline_font,
+                           const rgb_matrix::Font &font, const Color &color,
+                           const Color &outline_color, const Color &bg_color,
+                           const char *text, int letter_spacing) {
+  if (outline_font) {
+    // The outline font, we need to write with a negative (-2) text-spacing,
+    // as we want to have the same letter pitch as the regular text that
+    // we then write on top.
+    rgb_matrix::DrawText(canvas, *outline_font, x - 1, y,
+                         outline_color, &bg_color, text, letter_spacing - 2);
+  }
+  rgb_matrix::DrawText(canvas, font, x, y, color,
+                       outline_font ? NULL : &bg_color, text, letter_spacing);
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options matrix_options;
   rgb_matrix::RuntimeOptions runtime_opt;
@@ -178,33 +195,54 @@ int main(int argc, char *argv[]) {
   int delay_speed_usec = 1000000 / speed / font.CharacterWidth('W');
   if (delay_speed_usec < 0) delay_speed_usec = 2000;
 
+  // If the matrix allows, the text is drawn only once, onto two canvases
+  // wider than the matrix. Each step then only shows them at another offset:
+  // the text position x is at offset scroll_x - x.
+  // Two of them, as the offset of the one on the screen can't change before
+  // the step is due.
+  length = rgb_matrix::MeasureText(font, line.c_str(), letter_spacing);
+  const int scroll_x = x_orig + 1;  // Room for the outline.
+  FrameCanvas *scroll_canvas[2] = { NULL, NULL };
+  if (x_orig >= 0) {
+    scroll_canvas[0] = canvas->CreateScrollCanvas(scroll_x + length
+                                                  + canvas->width());
+  }
+  if (scroll_canvas[0]) {
+    DrawScrollText(scroll_canvas[0], scroll_x, y + font.baseline(),
+                   outline_font, font, color, outline_color, bg_color,
+                   line.c_str(), letter_spacing);
+    scroll_canvas[1] = canvas->CreateScrollCanvas(scroll_canvas[0]->width());
+    scroll_canvas[1]->CopyFrom(*scroll_canvas[0]);
+    offscreen_canvas = scroll_canvas[0];
+  }
+  int scroll_index = 0;
+
+  // Each step is scheduled at an absolute time, so the time it takes to
+  // draw does not slow down the scrolling.
+  int64_t show_at_usec = rgb_matrix::GetPresentationClockMicros();
+
   while (!interrupt_received && loops != 0) {
-    offscreen_canvas->Clear(); // clear canvas
-
-    if (outline_font) {
-      // The outline font, we need to write with a negative (-2) text-spacing,
-      // as we want to have the same letter pitch as the regular text that
-      // we then write on top.
-      rgb_matrix::DrawText(offscreen_canvas, *outline_font,
-                           x - 1, y + font.baseline(),
-                           outline_color, &bg_color,
-                           line.c_str(), letter_spacing - 2);
+    if (scroll_canvas[0]) {
+      offscreen_canvas = scroll_canvas[scroll_index];
+      scroll_index ^= 1;
+      offscreen_canvas->SetScrollOffset(scroll_x - x);
+    } else {
+      offscreen_canvas->Clear(); // clear canvas
+      DrawScrollText(offscreen_canvas, x, y + font.baseline(), outline_font,
+                     font, color, outline_color, bg_color, line.c_str(),
+                     letter_spacing);
     }
 
-    // length = holds how many pixels our text takes up
-    length = rgb_matrix::DrawText(offscreen_canvas, font,
-                                  x, y + font.baseline(),
-                                  color, outline_font ? NULL : &bg_color,
-                                  line.c_str(), letter_spacing);
-
     if (--x + length < 0) {
       x = x_orig;
       if (loops > 0) --loops;
     }
 
-    usleep(delay_speed_usec);
-    // Swap the offscreen_canvas with canvas on vsync, avoids flickering
-    offscreen_canvas = canvas->SwapOnVSync(offscreen_canvas);
+    // Show the offscreen_canvas on vsync at the next step, avoids
+    // flickering. We get back the canvas it replaced to draw on next.
+    show_at_usec += delay_speed_usec;
+    canvas->PresentAt(offscreen_canvas, show_at_usec);
+    offscreen_canvas = canvas->AwaitRetiredCanvas(NULL);
   }
 
   // Finished. Shut down the RGB matrix.
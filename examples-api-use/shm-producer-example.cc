@@ -0,0 +1,58 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Renders into the matrix of another process through shared memory: this
+// program does not need root and does not touch the GPIO. Start the matrix
+// process first, e.g.
+//   sudo ../utils/led-shm-server --led-rows=16 --led-cols=32
+//
+// This code is public domain
+// (but note, that the led-matrix library this depends on is GPL v2)
+
+#include "led-matrix.h"
+#include "shm-frame-ring.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+
+using rgb_matrix::ShmFrameProducer;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+int main(int argc, char *argv[]) {
+  const char *shm_name = argc > 1 ? argv[1] : "/led-matrix";
+  ShmFrameProducer *producer = ShmFrameProducer::Attach(shm_name);
+  if (producer == NULL)
+    return 1;
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  const int width = producer->width();
+  const int height = producer->height();
+  const int64_t frame_us = 1000000 / 60;
+  int64_t show_at_us = rgb_matrix::GetPresentationClockMicros();
+  for (int frame = 0; !interrupt_received; ++frame) {
+    // The frame is rendered right into shared memory.
+    uint8_t *rgb = producer->BeginFrame(1000);
+    if (rgb == NULL) {
+      fprintf(stderr, "Matrix process is gone or does not keep up.\n");
+      break;
+    }
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        *rgb++ = (x + frame) * 255 / width;
+        *rgb++ = y * 255 / height;
+        *rgb++ = frame;
+      }
+    }
+    // Scheduled at a fixed frame rate; the matrix process shows it then.
+    show_at_us += frame_us;
+    producer->EndFrame(show_at_us);
+  }
+
+  delete producer;
+  return 0;
+}
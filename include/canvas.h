@@ -46,6 +46,22 @@ public:
 
   // Fill screen with given 24bpp color.
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) = 0;
+
+  // Fill the "width" x "height" rectangle with its top left corner at (x,y)
+  // with given 24bpp color. Parts outside the canvas are ignored.
+  // The default sets each pixel; implementations can do this faster.
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    if (x < 0) { width += x; x = 0; }
+    if (y < 0) { height += y; y = 0; }
+    if (x + width > this->width()) width = this->width() - x;
+    if (y + height > this->height()) height = this->height() - y;
+    for (int row = y; row < y + height; ++row) {
+      for (int col = x; col < x + width; ++col) {
+        SetPixel(col, row, red, green, blue);
+      }
+    }
+  }
 };
 
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
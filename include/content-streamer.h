@@ -15,6 +15,7 @@
 #include <stdlib.h>
 
 #include <string>
+#include <vector>
 
 namespace rgb_matrix {
 class FrameCanvas;
@@ -33,6 +34,18 @@ public:
   // Write bytes from buffer. Similar to Posix behavior that allows short
   // writes.
   virtual ssize_t Append(const void *buf, size_t count) = 0;
+
+  // If the content is available in memory, return a pointer to the next
+  // "count" bytes and advance past them, without copying. The memory stays
+  // valid as long as the StreamIO exists.
+  // Returns NULL if not supported or fewer than "count" bytes are left; in
+  // that case the position is unchanged and Read() needs to be used.
+  virtual const char *ReadInPlace(size_t count) { return NULL; }
+
+  // Random access, needed for StreamReader::Seek(). Default implementation
+  // is for streams that can't do that: Seek() returns false, Size() -1.
+  virtual bool Seek(int64_t offset) { return false; }  // From beginning.
+  virtual int64_t Size() { return -1; }
 };
 
 class FileStreamIO : public StreamIO {
@@ -43,9 +56,35 @@ public:
   virtual void Rewind();
   virtual ssize_t Read(void *buf, size_t count);
   virtual ssize_t Append(const void *buf, size_t count);
+  virtual bool Seek(int64_t offset);
+  virtual int64_t Size();
+
+private:
+  const int fd_;
+};
+
+// Read-only access to a stream file that is memory mapped. A StreamReader
+// reading from it does not copy frames, but lets the FrameCanvas refer to
+// them in place (see FrameCanvas::DeserializeNoCopy()). So the MmapStreamIO
+// needs to outlive any FrameCanvas filled from it.
+// If the file can't be mapped, this falls back to regular reads.
+class MmapStreamIO : public StreamIO {
+public:
+  explicit MmapStreamIO(int fd);  // Takes ownership of fd.
+  ~MmapStreamIO();
+
+  virtual void Rewind();
+  virtual ssize_t Read(void *buf, size_t count);
+  virtual ssize_t Append(const void *buf, size_t count);  // Not supported.
+  virtual const char *ReadInPlace(size_t count);
+  virtual bool Seek(int64_t offset);
+  virtual int64_t Size();
 
 private:
   const int fd_;
+  char *data_;   // NULL if not mapped.
+  size_t size_;
+  size_t pos_;
 };
 
 class MemStreamIO : public StreamIO {
@@ -53,16 +92,36 @@ public:
   virtual void Rewind();
   virtual ssize_t Read(void *buf, size_t count);
   virtual ssize_t Append(const void *buf, size_t count);
+  virtual bool Seek(int64_t offset);
+  virtual int64_t Size();
 
 private:
   std::string buffer_;  // super simplistic.
   size_t pos_;
 };
 
+// Position and hold time of a frame in a stream.
+struct StreamIndexEntry {
+  uint64_t offset;
+  uint32_t hold_time_us;
+  uint32_t flags;  // Bit 0: stored as delta to the previous frame.
+};
+
 class StreamWriter {
 public:
   // Does not take ownership of StreamIO
-  StreamWriter(StreamIO *io);
+  //
+  // If "keyframe_interval" is > 0, frames are stored as the words that
+  // changed since the previous frame, with a full frame at least every
+  // "keyframe_interval" frames. Content that changes only in parts, such as
+  // scrolling text, then needs a fraction of the space.
+  //
+  // Frames with fewer than the maximum PWM bits only store the bitplanes
+  // that are shown (see FrameCanvas::SerializeActivePlanes()).
+  StreamWriter(StreamIO *io, int keyframe_interval = 0);
+
+  // Appends the frame index, so the StreamIO needs to still be around.
+  ~StreamWriter();
 
   // Stream out given canvas at the given time. "hold_time_us" indicates
   // for how long this frame is to be shown in microseconds.
@@ -70,9 +129,18 @@ public:
 
 private:
   void WriteFileHeader(const FrameCanvas &frame, size_t len);
+  void WriteIndex();
 
   StreamIO *const io_;
   bool header_written_;
+  uint64_t offset_;  // Bytes written so far.
+  std::vector<StreamIndexEntry> index_;
+
+  const int keyframe_interval_;
+  int frames_since_keyframe_;
+  std::vector<uint32_t> previous_;  // Previous frame to build delta against.
+  std::vector<uint32_t> delta_;
+  std::vector<uint32_t> active_planes_;
 };
 
 class StreamReader {
@@ -88,18 +156,46 @@ public:
   // or end of stream reached..
   bool GetNext(FrameCanvas *frame, uint32_t* hold_time_us);
 
+  // Number of frames in the stream, or -1 if it can't be determined because
+  // the StreamIO can't Seek(). Uses the index StreamWriter appends to
+  // the stream; older streams without one are scanned once.
+  int FrameCount();
+
+  // Position the stream, so that the next GetNext() returns frame number
+  // "frame" (0 is the first). Returns false if the frame does not exist or
+  // the StreamIO can't Seek().
+  bool Seek(int frame);
+
 private:
   enum State {
     STREAM_AT_BEGIN,
     STREAM_READING,
     STREAM_ERROR,
   };
-  bool ReadFileHeader(const FrameCanvas &frame);
+  bool ReadFileHeader();
+  bool ReadFrame(const char **data, size_t *len, uint8_t *pwm_bits,
+                 uint32_t *hold_time_us);
+  bool LoadIndex();
+  bool ReadIndex(int64_t stream_size);
+  void ScanIndex(int64_t stream_size);
 
   StreamIO *io_;
   size_t buf_size_;
+  int width_, height_;
+  bool has_delta_frames_;
   State state_;
+  int next_frame_;
+
+  enum { INDEX_NOT_LOADED, INDEX_LOADED, INDEX_UNAVAILABLE } index_state_;
+  std::vector<StreamIndexEntry> index_;
+  uint64_t frames_end_;  // Offset after the last frame.
 
   char *buffer_;
+  // buffer_ has the previous frame to apply deltas to, with buffer_len_
+  // bytes and buffer_pwm_bits_.
+  bool buffer_valid_;
+  size_t buffer_len_;
+  uint8_t buffer_pwm_bits_;
+  std::vector<uint32_t> delta_buffer_;
 };
 }
@@ -111,6 +111,11 @@ public:
 
   // If SendPulse() is asynchronously implemented, wait for pulse to finish.
   virtual void WaitPulseFinished() {}
+
+  // Make all following pulses "scale" (0..1) times as long as given in
+  // nano_wait_spec. Pulses that get shorter than the implementation can do
+  // are not sent at all. The default ignores the scale.
+  virtual void SetTimingScale(float scale) {}
 };
 
 }  // end namespace rgb_matrix
@@ -95,6 +95,11 @@ int DrawText(Canvas *c, const Font &font, int x, int y,
 int DrawText(Canvas *c, const Font &font, int x, int y, const Color &color,
              const char *utf8_text);
 
+// Returns how many pixels DrawText() would advance for "utf8_text" with
+// "font" and "kerning_offset", without drawing anything.
+int MeasureText(const Font &font, const char *utf8_text,
+                int kerning_offset = 0);
+
 // Draw text, a standard NUL terminated C-string encoded in UTF-8,
 // with given "font" at "x","y" with "color".
 // Draw text as above, but vertically (top down).
@@ -113,6 +118,14 @@ void DrawCircle(Canvas *c, int x, int y, int radius, const Color &color);
 // Draw a line from "x0", "y0" to "x1", "y1" and with "color"
 void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color);
 
+// Draw a horizontal line from "x0" to "x1" (both included) at "y" with "color"
+void DrawHLine(Canvas *c, int x0, int x1, int y, const Color &color);
+
+// Fill the "width" x "height" rectangle with its top left corner at "x", "y"
+// with "color". Much faster than drawing it pixel by pixel on a FrameCanvas.
+void FillRect(Canvas *c, int x, int y, int width, int height,
+              const Color &color);
+
 }  // namespace rgb_matrix
 
 #endif  // RPI_GRAPHICS_H
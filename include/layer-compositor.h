@@ -0,0 +1,135 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Content made of parts that change at different rates, such as a static
+// background, a logo and a live reading on top, can be kept in layers
+// instead of being drawn again as a whole for each frame.
+//
+// Each Layer is a Canvas with an alpha value per pixel, and remembers which
+// rectangle changed since the last Compose(). Compose() blends only that
+// rectangle of all layers onto the FrameCanvas, so the cost of a frame
+// follows the size of the change, not of the screen.
+#ifndef RPI_LAYER_COMPOSITOR_H
+#define RPI_LAYER_COMPOSITOR_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "canvas.h"
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+// The pixels [x0, x1) x [y0, y1); empty if x0 >= x1 or y0 >= y1.
+struct LayerRect {
+  LayerRect() : x0(0), y0(0), x1(0), y1(0) {}
+  LayerRect(int x0, int y0, int x1, int y1)
+    : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+  bool empty() const { return x0 >= x1 || y0 >= y1; }
+  // Grow to also cover "other".
+  void Add(const LayerRect &other);
+
+  int x0, y0, x1, y1;
+};
+
+class Layer : public Canvas {
+public:
+  // All pixels start transparent.
+  Layer(int width, int height);
+  virtual ~Layer();
+
+  // -- Canvas interface. Draws opaque pixels; Clear() makes all of them
+  // transparent, so the layers below show.
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
+
+  // Set a pixel that covers what is below by "alpha": 0 is transparent,
+  // 255 opaque.
+  void SetPixelAlpha(int x, int y, uint8_t red, uint8_t green, uint8_t blue,
+                     uint8_t alpha);
+  // Make a rectangle transparent.
+  void ClearRect(int x, int y, int width, int height);
+
+  // A hidden layer is left out of Compose().
+  void SetVisible(bool visible);
+  bool visible() const { return visible_; }
+
+  // R, G, B, alpha of each pixel, row by row.
+  const uint8_t *rgba() const { return rgba_; }
+
+private:
+  friend class LayerCompositor;
+  Layer(const Layer&);  // Not copyable.
+
+  // Clip to the layer; returns false if nothing is left.
+  bool Clip(int *x, int *y, int *width, int *height) const;
+  void Changed(int x, int y, int width, int height, bool drawn);
+
+  const int width_;
+  const int height_;
+  uint8_t *const rgba_;
+  bool visible_;
+  LayerRect dirty_;    // Changed since the last Compose().
+  LayerRect content_;  // Outside of it, all pixels are transparent.
+};
+
+class LayerCompositor {
+public:
+  // "layer_count" layers of "width" x "height", layer 0 at the bottom.
+  // Where all layers are transparent, the result is black.
+  LayerCompositor(int width, int height, int layer_count);
+  ~LayerCompositor();
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int layer_count() const { return (int)layers_.size(); }
+  Layer *layer(int index) { return layers_[index]; }
+
+  // Blend the layers onto "canvas", where they changed since "canvas" was
+  // composed the last time. A canvas composed for the first time gets
+  // all of it. This keeps track of each canvas, so it works with double
+  // buffering: compose onto the off-screen canvas, then swap it.
+  void Compose(FrameCanvas *canvas);
+
+  // Blend all layers in "rect" to "rgb", three bytes per pixel with rows
+  // "stride" bytes apart.
+  void Blend(const LayerRect &rect, uint8_t *rgb, int stride);
+
+private:
+  LayerCompositor(const LayerCompositor&);  // Not copyable.
+
+  struct ComposedCanvas {
+    FrameCanvas *canvas;
+    LayerRect outdated;  // Changed since it was composed.
+  };
+
+  const int width_;
+  const int height_;
+  std::vector<Layer*> layers_;
+  std::vector<ComposedCanvas> composed_;
+  std::vector<uint8_t> blended_;
+  std::vector<uint8_t> row_;  // Blended so far, four bytes per pixel.
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_LAYER_COMPOSITOR_H
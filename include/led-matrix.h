@@ -38,6 +38,31 @@ class Framebuffer;
 class PixelDesignatorMap;
 }
 
+// How the visible pixels of an RGBMatrix end up on the physical LEDs once
+// multiplexing and all pixel mappers are applied.
+// See RGBMatrix::GetPixelMappingReport().
+struct PixelMappingReport {
+  int visible_width, visible_height;    // The canvas as seen by the user.
+  int physical_width, physical_height;  // The un-mapped panel arrangement.
+
+  int unmapped;    // Visible pixels that don't reach any LED.
+  int collisions;  // Visible pixels sharing their LED with another one.
+  int holes;       // LEDs that no visible pixel reaches.
+
+  // For each visible pixel at index (y * visible_width + x), the index
+  // (physical_y * physical_width + physical_x) of its LED, or -1 if unmapped.
+  std::vector<int> visible_to_physical;
+
+  // Each visible pixel reaches exactly one LED and vice versa.
+  bool IsBijection() const {
+    return unmapped == 0 && collisions == 0 && holes == 0;
+  }
+};
+
+// Current time of the clock used by RGBMatrix::PresentAt(): CLOCK_MONOTONIC
+// in microseconds.
+int64_t GetPresentationClockMicros();
+
 // The RGB matrix provides the framebuffer and the facilities to constantly
 // update the LED matrix.
 //
@@ -207,6 +232,11 @@ public:
   // Returns a boolean indicating if this was successful.
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
+  // Report how the current pixel mapping covers the LEDs of the panels. This
+  // does not need any hardware, so it is also useful on an RGBMatrix that is
+  // constructed with a NULL GPIO just to check a configuration.
+  void GetPixelMappingReport(PixelMappingReport *report) const;
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // limited comic-colors, 1 might be sufficient. Lower require less CPU and
   // increases refresh-rate.
@@ -227,6 +257,16 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Set brightness in percent of the whole output, 1%..100%, without
+  // touching any FrameCanvas: the refresh switches the LEDs on for a
+  // correspondingly shorter time in each bit plane. Changes with the next
+  // refresh, or gradually over "ramp_ms" milliseconds, so this can follow
+  // e.g. the ambient light. At low values, the least significant bit planes
+  // get too short to show and the color depth goes down.
+  // Independent of SetBrightness(); both multiply.
+  void SetOutputBrightness(uint8_t percent, int ramp_ms = 0);
+  uint8_t output_brightness() const;
+
   //-- GPIO interaction
 
   // Return pointer to GPIO object for your own interaction with free
@@ -269,6 +309,17 @@ public:
   // don't have to worry about deleting them.
   FrameCanvas *CreateFrameCanvas();
 
+  // Create a FrameCanvas "width" pixels wide, wider than the matrix, of
+  // which the matrix shows a window; see FrameCanvas::SetScrollOffset().
+  // Draw once, then scrolling costs nothing: the refresh reads the canvas at
+  // the new offset. For content that wraps around, draw the first screen
+  // again at the end and restart at offset 0 when that is reached.
+  //
+  // This only works if a column on the canvas is a column of the chain of
+  // panels, so not with multiplexing or pixel mappers; then this returns
+  // NULL and writes a message to stderr.
+  FrameCanvas *CreateScrollCanvas(int width);
+
   // This method waits to the next VSync and swaps the active buffer with the
   // supplied buffer. The formerly active buffer is returned.
   //
@@ -283,8 +334,46 @@ public:
   // Default is 1, so immediately next available frame.
   // (Say you have 140Hz refresh rate, then a value of 5 would give you an
   // 28Hz animation, nicely locked to the frame-rate).
+  //
+  // Without refresh thread (no GPIO given), the buffers are swapped right
+  // away, so programs can run offline, e.g. to replay or test them.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  //-- Frame-accurate timing.
+  // Instead of sleeping between SwapOnVSync() calls, which adds up the time
+  // it takes to prepare each frame, canvases can be queued with the absolute
+  // time they should be shown. The refresh thread switches to them exactly
+  // at the first refresh after that time, so timing does not drift:
+  //
+  //   int64_t show_at = GetPresentationClockMicros();
+  //   for (;;) {
+  //     DrawNextFrame(offscreen);
+  //     show_at += frame_duration_us;
+  //     matrix->PresentAt(offscreen, show_at);
+  //     offscreen = matrix->AwaitRetiredCanvas(NULL);
+  //   }
+  //
+  // Don't mix with SwapOnVSync().
+
+  // Queue "canvas" to be shown at the first refresh that starts at or after
+  // "present_at_us" (see GetPresentationClockMicros()). Canvases are shown
+  // in the order they are queued; one that is still waiting when the next
+  // one is due already is skipped. If kPresentationQueueSize canvases are
+  // waiting already, this waits until one of them is shown.
+  // Returns 'false' if there is no refresh thread, e.g. without GPIO.
+  bool PresentAt(FrameCanvas *canvas, int64_t present_at_us);
+
+  // Wait until a canvas is off the screen, because it was replaced by a later
+  // one or skipped, and return it to be drawn on again. The first one
+  // returned is the one that was shown before the first PresentAt().
+  // If "presented_at_us" is not NULL, it receives the time the canvas was
+  // put on the screen or -1 if it was skipped.
+  // Returns NULL if none was returned within "timeout_ms" (< 0: no timeout).
+  FrameCanvas *AwaitRetiredCanvas(int64_t *presented_at_us,
+                                  int timeout_ms = -1);
+
+  static const int kPresentationQueueSize = 4;
+
   // -- Canvas interface. These write to the active FrameCanvas
   // (see documentation in canvas.h)
   virtual int width() const;
@@ -293,6 +382,8 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
 
 
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
@@ -319,14 +410,22 @@ private:
   void ApplyNamedPixelMappers(const char *pixel_mapper_config,
                               int chain, int parallel);
 
+  // A framebuffer with the geometry of the matrix to decode the designators
+  // of the shared pixel mapper with; the active canvas might be a wider
+  // scroll canvas.
+  internal::Framebuffer *matrix_framebuffer() const;
+
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
   void ApplyStaticTransformerDeprecated(const CanvasTransformer &transformer);
 #endif  // REMOVE_DEPRECATED_TRANSFORMERS
 
   Options params_;
   bool do_luminance_correct_;
+  uint8_t output_brightness_;
 
-  FrameCanvas *active_;
+  // The canvas on the screen. With PresentAt(), the refresh thread sets it
+  // when it shows the next one.
+  FrameCanvas *volatile active_;
 
   GPIO *io_;
   Mutex active_frame_sync_;
@@ -375,9 +474,64 @@ public:
   // This method should only be called if FrameCanvas is off-screen.
   bool Deserialize(const char *data, size_t len);
 
+  // Like Deserialize(), but without copying: the FrameCanvas shows "data"
+  // in place, e.g. a frame inside a memory mapped stream file. The data
+  // must stay unchanged and valid for as long as this FrameCanvas refers to
+  // it, i.e. until the next Deserialize(), Clear() or similar. Drawing on
+  // the canvas first makes a private copy, so "data" is never written to.
+  // Returns 'false' if size is unexpected.
+  bool DeserializeNoCopy(const char *data, size_t len);
+
+  // Like Serialize(), but only stores the bitplanes that are shown with the
+  // current pwmbits(); with e.g. 3 PWM bits, this is less than a third of the
+  // size. The content is copied to "data" if it fits in "len" bytes.
+  // Returns the number of bytes needed; "pwm_bits" is set to the PWM bits
+  // to pass to DeserializeActivePlanes().
+  size_t SerializeActivePlanes(char *data, size_t len,
+                               uint8_t *pwm_bits) const;
+
+  // Load data previously stored with SerializeActivePlanes(). The planes not
+  // stored are cleared; pwmbits() of this canvas is not changed.
+  // Returns 'false' if size or "pwm_bits" is unexpected.
+  bool DeserializeActivePlanes(const char *data, size_t len,
+                               uint8_t pwm_bits);
+
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  // Copy the "width" x "height" pixels at "src_x","src_y" of "src" to
+  // "dst_x","dst_y" of this canvas, e.g. to stamp parts that were rendered
+  // once into each new frame. "src" needs to be owned by the same RGBMatrix;
+  // it can be this canvas, also with overlapping rectangles. Parts outside
+  // of either canvas are not copied. Runs of pixels that are neighbours in
+  // memory on both sides are copied word by word per bit plane.
+  void CopyRect(const FrameCanvas &src, int src_x, int src_y,
+                int width, int height, int dst_x, int dst_y);
+
+  // Set the "width" x "height" pixels starting at (x, y) from packed RGB,
+  // three bytes per pixel, rows of "rgb" being "stride" bytes apart.
+  // Parts outside the canvas are ignored. Same result as calling SetPixel()
+  // for each pixel, but much faster for whole frames.
+  void SetPixels(int x, int y, int width, int height,
+                 const uint8_t *rgb, int stride);
+
+  // Same for an image of color indexes, one byte per pixel: "palette_rgb"
+  // holds R, G, B for each of the "palette_size" indexes. Pixels with index
+  // "transparent_index" or outside the palette are left as they are; pass
+  // -1 as "transparent_index" to set all the others.
+  // Each palette color is mapped only once per call.
+  void SetIndexedPixels(int x, int y, int width, int height,
+                        const uint8_t *indexes, int stride,
+                        const uint8_t *palette_rgb, int palette_size,
+                        int transparent_index);
+
+  // Show the columns starting at "x" of a canvas created with
+  // RGBMatrix::CreateScrollCanvas(); clamped so that the window stays on the
+  // canvas. Also on the active canvas, this only takes effect with the start
+  // of the next frame, so a frame never shows two offsets.
+  void SetScrollOffset(int x);
+  int scroll_offset() const;
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -385,6 +539,8 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
 
 private:
   friend class RGBMatrix;
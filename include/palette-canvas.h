@@ -0,0 +1,98 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Content with few colors, such as a sign that only knows a handful, can be
+// kept as one palette index per pixel. Drawing then is writing a byte, and
+// changing a palette entry recolors everything drawn with it, e.g. a status
+// lamp going from red to green, without drawing anything again.
+// The matrix shows FrameCanvases; CopyTo() puts the content onto one, with
+// each palette color mapped to bit planes only once.
+#ifndef RPI_PALETTE_CANVAS_H
+#define RPI_PALETTE_CANVAS_H
+
+#include <stdint.h>
+
+#include "canvas.h"
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+class PaletteCanvas : public Canvas {
+public:
+  // All pixels start with index 0, all palette entries as black.
+  PaletteCanvas(int width, int height);
+  virtual ~PaletteCanvas();
+
+  // -- Canvas interface. Colors are drawn as the index of the palette entry
+  // closest to them, see FindColor().
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+  virtual void Clear();   // Sets all pixels to index 0.
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
+
+  // -- Palette
+  void SetPaletteColor(uint8_t index, uint8_t red, uint8_t green,
+                       uint8_t blue);
+  // R, G, B of each of the palette_size() entries.
+  const uint8_t *palette() const { return palette_; }
+  // One more than the highest index SetPaletteColor() was called with; at
+  // least 1, for the black index 0 is there from the start.
+  int palette_size() const { return palette_size_; }
+
+  // The first palette entry with exactly this color, or else the closest.
+  uint8_t FindColor(uint8_t red, uint8_t green, uint8_t blue) const;
+
+  // -- Indexes
+  void SetIndex(int x, int y, uint8_t index);
+  uint8_t GetIndex(int x, int y) const;   // 0 outside of the canvas.
+  void FillIndex(uint8_t index);
+  // Rows of the indexes, width() bytes each.
+  const uint8_t *indexes() const { return indexes_; }
+
+  // Same as FrameCanvas::SetIndexedPixels(): the colors of "palette_rgb"
+  // are drawn with FindColor().
+  void SetIndexedPixels(int x, int y, int width, int height,
+                        const uint8_t *indexes, int stride,
+                        const uint8_t *palette_rgb, int palette_size,
+                        int transparent_index);
+
+  // Draw the whole content with the current palette, top left at "x","y"
+  // of "canvas". Indexes beyond palette_size() are not drawn.
+  void CopyTo(FrameCanvas *canvas, int x = 0, int y = 0) const;
+
+private:
+  PaletteCanvas(const PaletteCanvas&);  // Not copyable.
+
+  // FindColor() through a cache of the last color, as drawing tends to use
+  // the same color for many pixels in a row.
+  uint8_t ColorIndex(uint8_t red, uint8_t green, uint8_t blue);
+
+  const int width_;
+  const int height_;
+  uint8_t *const indexes_;
+  uint8_t palette_[256 * 3];
+  int palette_size_;
+
+  bool last_valid_;
+  uint8_t last_rgb_[3];
+  uint8_t last_index_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_PALETTE_CANVAS_H
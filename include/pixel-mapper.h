@@ -77,6 +77,9 @@ public:
   // length and half height panel (32x16 -> 64x8).
   // The logic_x, logic_y are output parameters and guaranteed not to be
   // nullptr.
+  //
+  // For large displays, this is called from several threads at once for
+  // different pixels, so it must not modify any state.
   virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
                                   int visible_x, int visible_y,
                                   int *matrix_x, int *matrix_y) const = 0;
@@ -0,0 +1,135 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Hand frames from other processes to the process that owns the matrix,
+// through a ring of frame slots in POSIX shared memory.
+//
+// The matrix process (e.g. utils/led-shm-server) creates the ring with
+// ShmFrameConsumer. Producers attach with ShmFrameProducer, which never
+// touches the GPIO: they don't need to run as root, and they render straight
+// into shared memory without a system call per pixel or frame. The two sides
+// only wake each other up with a futex when one of them has to wait.
+//
+// There is one producer at a time; a second one fails to attach.
+#ifndef RPI_SHM_FRAME_RING_H
+#define RPI_SHM_FRAME_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+struct ShmRingHeader;
+
+enum ShmFrameFormat {
+  // width * height pixels, row by row, three bytes R, G, B each.
+  kShmFrameRGB24 = 0,
+  // FrameCanvas::Serialize() of a canvas with the same options as the
+  // matrix process uses, i.e. already converted to bitplanes.
+  kShmFrameBitplanes = 1,
+};
+
+class ShmFrameConsumer {
+public:
+  // Create the ring "name" (a POSIX shm name such as "/led-matrix") for
+  // frames of "width" x "height" pixels; "bitplane_size" is the size of a
+  // serialized FrameCanvas of the matrix. A ring with the same name left
+  // over from an earlier run is replaced. "mode" are the permissions of the
+  // shared memory object, i.e. who can attach as producer.
+  // Returns NULL and prints the reason on failure.
+  static ShmFrameConsumer *Create(const char *name, int width, int height,
+                                  size_t bitplane_size, int slots,
+                                  mode_t mode);
+  ~ShmFrameConsumer();  // Removes the ring.
+
+  // Wait for the next frame and put it into "canvas". "present_at_us" is
+  // the time the producer wants it shown (see GetPresentationClockMicros()),
+  // or 0 for as soon as possible.
+  // Returns false if no frame arrived within "timeout_ms" (< 0: no timeout)
+  // or the frame did not fit the canvas.
+  bool GetNext(FrameCanvas *canvas, int64_t *present_at_us, int timeout_ms);
+
+private:
+  ShmFrameConsumer(const std::string &name, ShmRingHeader *ring,
+                   size_t mapped_size, int width, int height,
+                   uint32_t slot_count, size_t slot_data_size);
+
+  const std::string name_;
+  ShmRingHeader *const ring_;
+  const size_t mapped_size_;
+  // The geometry the ring was created with. Producers can write to the
+  // ring header, so it is never read back from there.
+  const int width_;
+  const int height_;
+  const uint32_t slot_count_;
+  const size_t slot_data_size_;
+  const size_t slot_stride_;
+};
+
+class ShmFrameProducer {
+public:
+  // Attach to the ring "name" created by the matrix process.
+  // Returns NULL and prints the reason on failure.
+  static ShmFrameProducer *Attach(const char *name);
+  ~ShmFrameProducer();
+
+  int width() const;
+  int height() const;
+
+  // The size FrameCanvas::Serialize() has in the matrix process, for
+  // Send(). Producers need the same matrix options to get that.
+  size_t bitplane_size() const;
+
+  // Get the next free slot to render into as RGB24, i.e. width() * height()
+  // * 3 bytes. Waits while the matrix process has not caught up yet.
+  // Returns NULL if no slot got free within "timeout_ms" (< 0: no timeout).
+  uint8_t *BeginFrame(int timeout_ms = -1);
+
+  // Hand the frame from BeginFrame() over to the matrix process, to be
+  // shown at "present_at_us" (see GetPresentationClockMicros()) or
+  // as soon as possible if 0.
+  void EndFrame(int64_t present_at_us = 0);
+
+  // Send a canvas that is already converted to bitplanes. "canvas" needs to
+  // come from an RGBMatrix with the same options as the one of the matrix
+  // process; it can be created without GPIO as RGBMatrix(NULL, options).
+  // Returns false if the size does not match or there was no free slot
+  // within "timeout_ms".
+  bool Send(const FrameCanvas &canvas, int64_t present_at_us = 0,
+            int timeout_ms = -1);
+
+private:
+  ShmFrameProducer(int fd, ShmRingHeader *ring, size_t mapped_size,
+                   int width, int height, uint32_t slot_count,
+                   size_t slot_data_size, size_t bitplane_size);
+  uint8_t *AwaitFreeSlot(int timeout_ms);
+  void Publish(ShmFrameFormat format, size_t len, int64_t present_at_us);
+
+  const int fd_;
+  ShmRingHeader *const ring_;
+  const size_t mapped_size_;
+  // Checked against the mapping in Attach().
+  const int width_;
+  const int height_;
+  const uint32_t slot_count_;
+  const size_t slot_stride_;
+  const size_t bitplane_size_;
+};
+}  // namespace rgb_matrix
+
+#endif  // RPI_SHM_FRAME_RING_H
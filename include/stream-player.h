@@ -0,0 +1,71 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Play a content stream (see content-streamer.h) on the matrix in the
+// background, e.g. a splash screen while the program gets on with its work.
+//
+// Frames are rendered once into a stream, so playing them is no more than
+// reading them; from an MmapStreamIO not even a copy. Each frame is queued
+// with RGBMatrix::PresentAt() at the time it is due, measured from the
+// start, so the refresh thread switches frames on time no matter how busy
+// the rest of the program is.
+#ifndef RPI_STREAM_PLAYER_H
+#define RPI_STREAM_PLAYER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "thread.h"
+
+namespace rgb_matrix {
+class FrameCanvas;
+class RGBMatrix;
+class StreamIO;
+
+class StreamPlayer : public Thread {
+public:
+  // Does not take ownership of "matrix" or "io", which need to outlive
+  // the player. The stream is played in a loop until "duration_us" have
+  // passed since Start(), or once if "duration_us" is < 0.
+  //
+  // Don't SwapOnVSync() or PresentAt() on the matrix while playing. When
+  // the player is done, the matrix shows a cleared canvas.
+  StreamPlayer(RGBMatrix *matrix, StreamIO *io, int64_t duration_us);
+
+  // Stops playback and waits until it is done.
+  virtual ~StreamPlayer();
+
+  // End playback early. Does not wait; see WaitStopped().
+  void Stop();
+
+  virtual void Run();
+
+private:
+  // Wait until "time_us" (see GetPresentationClockMicros()). Returns false
+  // if Stop() was called before.
+  bool WaitUntil(int64_t time_us);
+
+  RGBMatrix *const matrix_;
+  StreamIO *const io_;
+  const int64_t duration_us_;
+  FrameCanvas *canvas_;
+
+  Mutex mutex_;
+  pthread_cond_t stop_changed_;
+  bool stop_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_STREAM_PLAYER_H
@@ -0,0 +1,110 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Signs tend to redraw the same labels ("kg", "GROSS", ...) over and over.
+// A TextSpriteCache renders each (font, colors, text) only once into a
+// TextSprite and afterwards just stamps that onto the FrameCanvas, skipping
+// the glyph lookup, the bitmap decoding and the per-pixel SetPixel().
+#ifndef RPI_TEXT_SPRITE_CACHE_H
+#define RPI_TEXT_SPRITE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "graphics.h"
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+// Text rendered once, to be drawn many times.
+class TextSprite {
+public:
+  // Draw at "x","y" the same way DrawText() would draw the text there.
+  // "y" is the baseline of the font.
+  void Draw(FrameCanvas *c, int x, int y) const;
+
+  // How many pixels DrawText() advances for this text.
+  int advance() const { return advance_; }
+
+  // Size of the image; the pixels the text actually covers.
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Memory taken by this sprite.
+  size_t bytes() const { return sizeof(*this) + pixels_.size(); }
+
+private:
+  friend class TextSpriteCache;
+  TextSprite() : advance_(0), x_offset_(0), y_offset_(0),
+                 width_(0), height_(0) {}
+
+  int advance_;
+  int x_offset_, y_offset_;   // Top left of the image relative to "x","y".
+  int width_, height_;
+  std::string pixels_;        // Palette index per pixel, 0 is transparent.
+  uint8_t palette_[3 * 3];    // Unused, foreground, background.
+};
+
+class TextSpriteCache {
+public:
+  // Keeps the least recently used sprites as long as all together take no
+  // more than "budget_bytes".
+  explicit TextSpriteCache(size_t budget_bytes = 256 * 1024);
+  ~TextSpriteCache();
+
+  // Get the sprite of "utf8_text" drawn with "font", "color",
+  // "background_color" (NULL for transparent) and "kerning_offset", as with
+  // DrawText(). Rendered if not in the cache yet.
+  // The sprite is owned by the cache and valid until the next call to Get().
+  // The font is identified by its address, so don't change a font after
+  // using it here, or Clear() the cache.
+  const TextSprite *Get(const Font &font, const Color &color,
+                        const Color *background_color,
+                        const char *utf8_text, int kerning_offset = 0);
+
+  // Same as rgb_matrix::DrawText(), but through the cache.
+  int DrawText(FrameCanvas *c, const Font &font, int x, int y,
+               const Color &color, const Color *background_color,
+               const char *utf8_text, int kerning_offset = 0);
+
+  // Drop all sprites.
+  void Clear();
+
+  size_t bytes_used() const { return bytes_used_; }
+  long hits() const { return hits_; }
+  long misses() const { return misses_; }
+
+private:
+  TextSpriteCache(const TextSpriteCache&);  // Not copyable.
+
+  struct Entry;
+  typedef std::list<Entry*> LruList;    // Most recently used first.
+  typedef std::map<std::string, LruList::iterator> EntryMap;
+
+  void EvictToBudget();
+
+  const size_t budget_bytes_;
+  size_t bytes_used_;
+  long hits_, misses_;
+  LruList lru_;
+  EntryMap entries_;
+};
+
+}  // namespace rgb_matrix
+
+#endif  // RPI_TEXT_SPRITE_CACHE_H
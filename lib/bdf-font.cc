@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+
 // The little question-mark box "�" for unknown code.
 static const uint32_t kUnicodeReplacementCodepoint = 0xFFFD;
 
@@ -166,10 +168,19 @@ int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
   if (g == NULL) g = FindGlyph(kUnicodeReplacementCodepoint);
   if (g == NULL) return 0;
   y_pos = y_pos - g->height - g->y_offset;
-  for (int y = 0; y < g->height; ++y) {
+
+  // Only rasterize the part of the glyph that is on the canvas; scrolling
+  // text is mostly off-screen.
+  const int x_start = std::max(0, -x_pos);
+  const int x_end = std::min(g->device_width, c->width() - x_pos);
+  const int y_start = std::max(0, -y_pos);
+  const int y_end = std::min(g->height, c->height() - y_pos);
+  if (x_start >= x_end || y_start >= y_end)
+    return g->device_width;
+  for (int y = y_start; y < y_end; ++y) {
     const rowbitmap_t row = g->bitmap[y];
-    rowbitmap_t x_mask = (1LL<<63);
-    for (int x = 0; x < g->device_width; ++x, x_mask >>= 1) {
+    rowbitmap_t x_mask = (1ULL<<63) >> x_start;
+    for (int x = x_start; x < x_end; ++x, x_mask >>= 1) {
       if (row & x_mask) {
         c->SetPixel(x_pos + x, y_pos + y, color.r, color.g, color.b);
       } else if (bgcolor) {
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -25,19 +26,44 @@ struct FileHeader {
   uint32_t buf_size;
   uint32_t width;
   uint32_t height;
-  uint64_t future_use1;
+  uint64_t flags;  // kFileFlag*
   uint64_t future_use2;
 };
+// Stream contains kFrameDelta frames, which need the previous frame.
+static const uint64_t kFileFlagDeltaFrames = 1 << 0;
 
 static const uint32_t kFrameMagicValue = 0x12345678;
 struct FrameHeader {
   uint32_t magic;  // kFrameMagic
   uint32_t size;
   uint32_t hold_time_us;  // How long this frame lasts in usec.
-  uint32_t future_use1;
+  uint32_t encoding;      // kFrameRaw or kFrameDelta
   uint64_t future_use2;
-  uint64_t future_use3;
+  uint32_t pwm_bits;      // 0: all planes; else SerializeActivePlanes()
+  uint32_t future_use3;
 };
+
+// Frame encodings.
+//  kFrameRaw: the serialized FrameCanvas, or only its active planes if
+//    pwm_bits is set.
+//  kFrameDelta: the words that changed compared to the previous frame, as
+//    spans of {uint32 words-to-skip, uint32 count, count words}.
+static const uint32_t kFrameRaw = 0;
+static const uint32_t kFrameDelta = 1;
+
+// Unchanged gaps of up to this many words are included in a span, as a new
+// span header would cost more than that.
+static const size_t kMaxDeltaGapWords = 2;
+
+// StreamIndexEntry::flags
+static const uint32_t kIndexDeltaFrame = 1 << 0;
+
+// After the last frame, StreamWriter appends an index: a FrameHeader with
+// kIndexMagicValue, "size" bytes of StreamIndexEntry, and a final
+// FrameHeader with kIndexMagicValue that has the offset of the index in
+// future_use2. This way it can be found from the end of the stream, and
+// sequential readers see it as end of stream.
+static const uint32_t kIndexMagicValue = 0x1D3E5A48;
 }
 
 FileStreamIO::FileStreamIO(int fd) : fd_(fd) {}
@@ -53,6 +79,69 @@ ssize_t FileStreamIO::Append(const void *buf, const size_t count) {
   return write(fd_, buf, count);
 }
 
+bool FileStreamIO::Seek(int64_t offset) {
+  return lseek(fd_, offset, SEEK_SET) == offset;
+}
+
+int64_t FileStreamIO::Size() {
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+  return st.st_size;
+}
+
+MmapStreamIO::MmapStreamIO(int fd) : fd_(fd), data_(NULL), size_(0), pos_(0) {
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return;
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (mapped == MAP_FAILED) {
+    perror("Can't mmap() stream; reading instead");
+    return;
+  }
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+  data_ = (char*) mapped;
+  size_ = st.st_size;
+}
+MmapStreamIO::~MmapStreamIO() {
+  if (data_) munmap(data_, size_);
+  close(fd_);
+}
+
+void MmapStreamIO::Rewind() {
+  if (data_) pos_ = 0; else lseek(fd_, 0, SEEK_SET);
+}
+
+ssize_t MmapStreamIO::Read(void *buf, size_t count) {
+  if (!data_) return read(fd_, buf, count);
+  const size_t amount = std::min(count, size_ - pos_);
+  memcpy(buf, data_ + pos_, amount);
+  pos_ += amount;
+  return amount;
+}
+
+ssize_t MmapStreamIO::Append(const void *buf, size_t count) { return -1; }
+
+bool MmapStreamIO::Seek(int64_t offset) {
+  if (!data_) return lseek(fd_, offset, SEEK_SET) == offset;
+  if (offset < 0 || (uint64_t)offset > size_) return false;
+  pos_ = offset;
+  return true;
+}
+
+int64_t MmapStreamIO::Size() {
+  if (data_) return size_;
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+  return st.st_size;
+}
+
+const char *MmapStreamIO::ReadInPlace(size_t count) {
+  if (!data_ || count > size_ - pos_) return NULL;
+  const char *result = data_ + pos_;
+  pos_ += count;
+  return result;
+}
+
 void MemStreamIO::Rewind() { pos_ = 0; }
 ssize_t MemStreamIO::Read(void *buf, size_t count) {
   const size_t amount = std::min(count, buffer_.size() - pos_);
@@ -64,6 +153,12 @@ ssize_t MemStreamIO::Append(const void *buf, size_t count) {
   buffer_.append((const char*)buf, count);
   return count;
 }
+bool MemStreamIO::Seek(int64_t offset) {
+  if (offset < 0 || (uint64_t)offset > buffer_.size()) return false;
+  pos_ = offset;
+  return true;
+}
+int64_t MemStreamIO::Size() { return buffer_.size(); }
 
 static ssize_t FullRead(StreamIO *io, void *buf, const size_t count) {
   int remaining = count;
@@ -88,7 +183,59 @@ static ssize_t FullAppend(StreamIO *io, const void *buf, const size_t count) {
   return count;
 }
 
-StreamWriter::StreamWriter(StreamIO *io) : io_(io), header_written_(false) {}
+// Encode the difference of "current" to "previous". Returns false if that
+// would not be smaller than the raw frame.
+static bool EncodeDelta(const uint32_t *previous, const uint32_t *current,
+                        size_t words, std::vector<uint32_t> *out) {
+  out->clear();
+  size_t pos = 0;
+  size_t last_end = 0;
+  while (pos < words) {
+    if (previous[pos] == current[pos]) {
+      ++pos;
+      continue;
+    }
+    size_t end = pos + 1;
+    for (size_t i = end; i < words; ++i) {
+      if (previous[i] != current[i])
+        end = i + 1;
+      else if (i - end >= kMaxDeltaGapWords)
+        break;
+    }
+    out->push_back(pos - last_end);
+    out->push_back(end - pos);
+    out->insert(out->end(), current + pos, current + end);
+    if (out->size() >= words) return false;
+    last_end = pos = end;
+  }
+  return true;
+}
+
+// Apply delta created by EncodeDelta() on top of the previous frame.
+static bool ApplyDelta(const uint32_t *delta, size_t delta_words,
+                       uint32_t *frame, size_t words) {
+  const uint32_t *const delta_end = delta + delta_words;
+  size_t pos = 0;
+  while (delta_end - delta >= 2) {
+    pos += delta[0];
+    const size_t count = delta[1];
+    delta += 2;
+    if (pos + count > words || (size_t)(delta_end - delta) < count)
+      return false;
+    memcpy(frame + pos, delta, count * sizeof(*delta));
+    pos += count;
+    delta += count;
+  }
+  return delta == delta_end;
+}
+
+StreamWriter::StreamWriter(StreamIO *io, int keyframe_interval)
+  : io_(io), header_written_(false), offset_(0),
+    keyframe_interval_(keyframe_interval), frames_since_keyframe_(0) {}
+StreamWriter::~StreamWriter() {
+  if (header_written_) WriteIndex();
+}
+
 bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   const char *data;
   size_t len;
@@ -101,8 +248,47 @@ bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   h.magic = kFrameMagicValue;
   h.size = len;
   h.hold_time_us = hold_time_us;
+  h.encoding = kFrameRaw;
+
+  // The planes below the PWM bits are not shown, so don't need to be stored.
+  // Asking with no room only returns the size; with all planes in use, the
+  // Serialize() buffer is written as is, without a copy.
+  uint8_t pwm_bits;
+  const size_t active_len = frame.SerializeActivePlanes(NULL, 0, &pwm_bits);
+  if (active_len < len) {
+    active_planes_.resize(active_len / sizeof(uint32_t));
+    frame.SerializeActivePlanes((char*) &active_planes_[0], active_len,
+                                &pwm_bits);
+    data = (const char*) &active_planes_[0];
+    len = active_len;
+    h.size = len;
+    h.pwm_bits = pwm_bits;
+  }
+  const char *payload = data;
+
+  if (keyframe_interval_ > 0) {
+    const size_t words = len / sizeof(uint32_t);
+    if (frames_since_keyframe_ < keyframe_interval_
+        && previous_.size() == words
+        && EncodeDelta(&previous_[0], (const uint32_t*)data, words, &delta_)) {
+      h.encoding = kFrameDelta;
+      h.size = delta_.size() * sizeof(uint32_t);
+      payload = h.size ? (const char*) &delta_[0] : data;
+      ++frames_since_keyframe_;
+    } else {
+      frames_since_keyframe_ = 1;
+    }
+    previous_.assign((const uint32_t*)data, (const uint32_t*)data + words);
+  }
+
+  StreamIndexEntry entry = {};
+  entry.offset = offset_;
+  entry.hold_time_us = hold_time_us;
+  entry.flags = (h.encoding == kFrameDelta) ? kIndexDeltaFrame : 0;
+  index_.push_back(entry);
   FullAppend(io_, &h, sizeof(h));
-  return FullAppend(io_, data, len) == (ssize_t)len;
+  offset_ += sizeof(h) + h.size;
+  return FullAppend(io_, payload, h.size) == (ssize_t)h.size;
 }
 
 void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
@@ -111,12 +297,32 @@ void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
   header.width = frame.width();
   header.height = frame.height();
   header.buf_size = len;
+  header.flags = keyframe_interval_ > 0 ? kFileFlagDeltaFrames : 0;
   FullAppend(io_, &header, sizeof(header));
+  offset_ += sizeof(header);
   header_written_ = true;
 }
 
+void StreamWriter::WriteIndex() {
+  const size_t index_bytes = index_.size() * sizeof(StreamIndexEntry);
+  FrameHeader h = {};
+  h.magic = kIndexMagicValue;
+  h.size = index_bytes;
+  FullAppend(io_, &h, sizeof(h));
+  if (index_bytes) FullAppend(io_, &index_[0], index_bytes);
+
+  FrameHeader footer = {};
+  footer.magic = kIndexMagicValue;
+  footer.future_use2 = offset_;  // Where the index starts.
+  FullAppend(io_, &footer, sizeof(footer));
+  offset_ += sizeof(h) + index_bytes + sizeof(footer);
+}
+
 StreamReader::StreamReader(StreamIO *io)
-  : io_(io), state_(STREAM_AT_BEGIN), buffer_(NULL) {
+  : io_(io), buf_size_(0), width_(0), height_(0), has_delta_frames_(false),
+    state_(STREAM_AT_BEGIN), next_frame_(0), index_state_(INDEX_NOT_LOADED),
+    frames_end_(0), buffer_(NULL), buffer_valid_(false), buffer_len_(0),
+    buffer_pwm_bits_(0) {
   io_->Rewind();
 }
 StreamReader::~StreamReader() { delete [] buffer_; }
@@ -124,47 +330,226 @@ StreamReader::~StreamReader() { delete [] buffer_; }
 void StreamReader::Rewind() {
   io_->Rewind();
   state_ = STREAM_AT_BEGIN;
+  next_frame_ = 0;
+  buffer_valid_ = false;
 }
 
 bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
-  if (state_ == STREAM_AT_BEGIN && !ReadFileHeader(*frame)) return false;
+  if (state_ == STREAM_AT_BEGIN && !ReadFileHeader()) return false;
   if (state_ != STREAM_READING) return false;
+  if (width_ != frame->width() || height_ != frame->height()) {
+    fprintf(stderr, "This stream is for %dx%d, can't play on %dx%d. "
+            "Please use the same settings for record/replay\n",
+            width_, height_, frame->width(), frame->height());
+    state_ = STREAM_ERROR;
+    return false;
+  }
+  const char *data;
+  size_t len;
+  uint8_t pwm_bits;
+  if (!ReadFrame(&data, &len, &pwm_bits, hold_time_us)) return false;
+  ++next_frame_;
+  if (pwm_bits) return frame->DeserializeActivePlanes(data, len, pwm_bits);
+  if (data != buffer_) return frame->DeserializeNoCopy(data, len);
+  return frame->Deserialize(data, len);
+}
+
+// Read the next frame. "data" is set to point to the "len" bytes of the frame,
+// which are either in place in the StreamIO or in buffer_. A non-zero
+// "pwm_bits" means only the active planes are stored. Delta frames are
+// decoded into buffer_, which then keeps the previous frame for the next delta.
+bool StreamReader::ReadFrame(const char **data, size_t *len,
+                             uint8_t *pwm_bits, uint32_t *hold_time_us) {
   FrameHeader h;
   if (FullRead(io_, &h, sizeof(h)) != sizeof(h)) return false;
 
   // TODO: we might allow for this to be a kFileMagicValue, to allow people
   // to just concatenate streams. In that case, we just would need to read
   // ahead past this header (both headers are designed to be same size)
+  if (h.magic == kIndexMagicValue)
+    return false;  // Regular end of stream.
   if (h.magic != kFrameMagicValue) {
     state_ = STREAM_ERROR;
     return false;
   }
-  // In the future, we might allow larger buffers (audio?), but never smaller.
-  if (h.size < buf_size_)
-    return false;
   if (hold_time_us) *hold_time_us = h.hold_time_us;
-  if (FullRead(io_, buffer_, buf_size_) != (ssize_t)buf_size_) return false;
-  return frame->Deserialize(buffer_, buf_size_);
+
+  if (h.encoding == kFrameDelta) {
+    if (!buffer_valid_) {
+      fprintf(stderr, "Stream: delta frame without preceding frame.\n");
+      state_ = STREAM_ERROR;
+      return false;
+    }
+    const char *delta = io_->ReadInPlace(h.size);
+    if (delta == NULL || (uintptr_t)delta % sizeof(uint32_t) != 0) {
+      delta_buffer_.resize(h.size / sizeof(uint32_t) + 1);
+      if (delta != NULL)
+        memcpy(&delta_buffer_[0], delta, h.size);
+      else if (FullRead(io_, &delta_buffer_[0], h.size) != (ssize_t)h.size)
+        return false;
+      delta = (const char*) &delta_buffer_[0];
+    }
+    if (!ApplyDelta((const uint32_t*)delta, h.size / sizeof(uint32_t),
+                    (uint32_t*)buffer_, buffer_len_ / sizeof(uint32_t))) {
+      state_ = STREAM_ERROR;
+      return false;
+    }
+    *data = buffer_;
+    *len = buffer_len_;
+    *pwm_bits = buffer_pwm_bits_;
+    return true;
+  }
+
+  size_t frame_len = buf_size_;
+  if (h.pwm_bits) {
+    if (h.size > buf_size_) {
+      state_ = STREAM_ERROR;
+      return false;
+    }
+    frame_len = h.size;
+  } else if (h.size < buf_size_) {
+    // In the future, we might allow larger buffers (audio?), but never
+    // smaller.
+    return false;
+  }
+  *len = frame_len;
+  *pwm_bits = h.pwm_bits;
+
+  // Frames in place can only be used if no delta is built on top of them.
+  const char *in_place = io_->ReadInPlace(frame_len);
+  if (in_place && !has_delta_frames_) {
+    *data = in_place;
+    return true;
+  }
+  if (in_place) {
+    memcpy(buffer_, in_place, frame_len);
+  } else if (FullRead(io_, buffer_, frame_len) != (ssize_t)frame_len) {
+    return false;
+  }
+  buffer_valid_ = true;
+  buffer_len_ = frame_len;
+  buffer_pwm_bits_ = h.pwm_bits;
+  *data = buffer_;
+  return true;
+}
+
+int StreamReader::FrameCount() {
+  return LoadIndex() ? (int)index_.size() : -1;
+}
+
+bool StreamReader::Seek(int frame) {
+  if (!LoadIndex() || frame < 0 || frame > (int)index_.size())
+    return false;
+  // Seeking to one past the last frame is allowed; it is the end of stream.
+  if (frame == (int)index_.size()) {
+    if (!io_->Seek(frames_end_)) return false;
+    state_ = STREAM_READING;
+    next_frame_ = frame;
+    return true;
+  }
+
+  // Delta frames need to be decoded starting at the previous key frame.
+  int start = frame;
+  while (start > 0 && (index_[start].flags & kIndexDeltaFrame))
+    --start;
+  if (!io_->Seek(index_[start].offset)) return false;
+  state_ = STREAM_READING;
+  buffer_valid_ = false;
+  for (int i = start; i < frame; ++i) {
+    const char *data;
+    size_t len;
+    uint8_t pwm_bits;
+    if (!ReadFrame(&data, &len, &pwm_bits, NULL)) return false;
+  }
+  next_frame_ = frame;
+  return true;
 }
 
-bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
+bool StreamReader::ReadFileHeader() {
   FileHeader header;
   FullRead(io_, &header, sizeof(header));
   if (header.magic != kFileMagicValue) {
     state_ = STREAM_ERROR;
     return false;
   }
-  if ((int)header.width != frame.width()
-      || (int)header.height != frame.height()) {
-    fprintf(stderr, "This stream is for %dx%d, can't play on %dx%d. "
-            "Please use the same settings for record/replay\n",
-            header.width, header.height, frame.width(), frame.height());
-    state_ = STREAM_ERROR;
-    return false;
-  }
   state_ = STREAM_READING;
+  width_ = header.width;
+  height_ = header.height;
+  has_delta_frames_ = (header.flags & kFileFlagDeltaFrames) != 0;
+  buffer_valid_ = false;
+  if (buffer_ && buf_size_ != header.buf_size) {
+    delete [] buffer_;
+    buffer_ = NULL;
+  }
   buf_size_ = header.buf_size;
   if (!buffer_) buffer_ = new char [ header.buf_size ];
   return true;
 }
+
+bool StreamReader::LoadIndex() {
+  if (index_state_ != INDEX_NOT_LOADED)
+    return index_state_ == INDEX_LOADED;
+  index_state_ = INDEX_UNAVAILABLE;
+  const int64_t stream_size = io_->Size();
+  if (stream_size < (int64_t)sizeof(FileHeader) || !io_->Seek(0))
+    return false;
+  const State previous_state = state_;
+  const int previous_frame = next_frame_;
+  if (!ReadFileHeader())
+    return false;
+
+  if (!ReadIndex(stream_size)) {
+    index_.clear();
+    ScanIndex(stream_size);
+  }
+  index_state_ = INDEX_LOADED;
+
+  // Continue where we were.
+  if (previous_state == STREAM_AT_BEGIN)
+    Rewind();
+  else
+    Seek(previous_frame);
+  return true;
+}
+
+// Read index appended by StreamWriter. Returns false if there is none.
+bool StreamReader::ReadIndex(int64_t stream_size) {
+  FrameHeader footer;
+  if (stream_size < (int64_t)(sizeof(FileHeader) + 2 * sizeof(FrameHeader))
+      || !io_->Seek(stream_size - sizeof(footer))
+      || FullRead(io_, &footer, sizeof(footer)) != sizeof(footer)
+      || footer.magic != kIndexMagicValue
+      || footer.future_use2 < sizeof(FileHeader)
+      || (int64_t)footer.future_use2 > stream_size)
+    return false;
+
+  FrameHeader h;
+  if (!io_->Seek(footer.future_use2)
+      || FullRead(io_, &h, sizeof(h)) != sizeof(h)
+      || h.magic != kIndexMagicValue
+      || h.size % sizeof(StreamIndexEntry) != 0)
+    return false;
+  index_.resize(h.size / sizeof(StreamIndexEntry));
+  frames_end_ = footer.future_use2;
+  return index_.empty()
+    || FullRead(io_, &index_[0], h.size) == (ssize_t)h.size;
+}
+
+// No index in the stream: find frames by walking the frame headers.
+void StreamReader::ScanIndex(int64_t stream_size) {
+  uint64_t offset = sizeof(FileHeader);
+  FrameHeader h;
+  while (offset + sizeof(h) <= (uint64_t)stream_size
+         && io_->Seek(offset)
+         && FullRead(io_, &h, sizeof(h)) == sizeof(h)
+         && h.magic == kFrameMagicValue) {
+    StreamIndexEntry entry = {};
+    entry.offset = offset;
+    entry.hold_time_us = h.hold_time_us;
+    entry.flags = (h.encoding == kFrameDelta) ? kIndexDeltaFrame : 0;
+    index_.push_back(entry);
+    offset += sizeof(h) + h.size;
+  }
+  frames_end_ = offset;
+}
 }  // namespace rgb_matrix
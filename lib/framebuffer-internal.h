@@ -25,6 +25,7 @@ class GPIO;
 class PinPulser;
 namespace internal {
 class RowAddressSetter;
+struct ColorLookup;
 
 // An opaque type used within the framebuffer that can be used
 // to copy between PixelMappers.
@@ -44,7 +45,12 @@ public:
 
   // Get a writable version of the PixelDesignator. Outside Framebuffer used
   // by the RGBMatrix to re-assign mappings to new PixelDesignatorMappers.
-  PixelDesignator *get(int x, int y);
+  // Inline, as it is on the path of every SetPixel().
+  inline PixelDesignator *get(int x, int y) {
+    if (x < 0 || y < 0 || x >= width_ || y >= height_)
+      return NULL;
+    return buffer_ + (y*width_) + x;
+  }
 
   inline int width() const { return width_; }
   inline int height() const { return height_; }
@@ -59,6 +65,20 @@ private:
   PixelDesignator *const buffer_;
 };
 
+// Filling a PixelDesignatorMap touches every pixel, which adds up on large
+// walls. Work that can be split into independent row ranges implements this
+// interface; ProcessRows() may be called concurrently for disjoint ranges.
+class RowRangeFunction {
+public:
+  virtual ~RowRangeFunction() {}
+  virtual void ProcessRows(int y_start, int y_end) = 0;
+};
+
+// Call work->ProcessRows() for ranges covering [0, height). If there is
+// enough work (height * width pixels) and more than one core, the ranges are
+// handed to worker threads; returns once all of them are done.
+void ProcessRowsInParallel(int width, int height, RowRangeFunction *work);
+
 // Internal representation of the frame-buffer that as well can
 // write itself to GPIO.
 // Our internal memory layout mimicks as much as possible what needs to be
@@ -66,18 +86,29 @@ private:
 class Framebuffer {
 public:
   Framebuffer(int rows, int columns, int parallel,
-              int scan_mode,
               const char* led_sequence, bool inverse_color,
               PixelDesignatorMap **mapper);
+  // A framebuffer "columns" wide of which the refresh only shows
+  // "output_columns", starting at the column set with SetOutputOffset().
+  // It has its own PixelDesignatorMap with the default, unmapped layout.
+  Framebuffer(int rows, int columns, int output_columns, int parallel,
+              const char* led_sequence, bool inverse_color);
   ~Framebuffer();
 
-  // Initialize GPIO bits for output. Only call once.
-  static void InitHardwareMapping(const char *named_hardware);
+  // Initialize GPIO bits for output. Only call once. "rows" and
+  // "row_address_type" are the panel settings the mapping needs to serve.
+  static void InitHardwareMapping(const char *named_hardware,
+                                  int rows, int row_address_type);
   static void InitGPIO(GPIO *io, int rows, int parallel,
                        bool allow_hardware_pulsing,
                        int pwm_lsb_nanoseconds,
                        int dither_bits,
-                       int row_address_type);
+                       int row_address_type,
+                       int scan_mode);
+
+  // Scale the time the LEDs are on for each bit plane by "scale" (0..1).
+  // Only call from the thread that does DumpToMatrix().
+  static void SetOutputScale(float scale);
 
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
@@ -86,34 +117,85 @@ public:
   uint8_t pwmbits() { return pwm_bits_; }
 
   // Map brightness of output linearly to input with CIE1931 profile.
-  void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
+  void set_luminance_correct(bool on);
   bool luminance_correct() const { return do_luminance_correct_; }
 
   // Set brightness in percent; range=1..100
   // This will only affect newly set pixels.
-  void SetBrightness(uint8_t b) {
-    brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
-  }
+  void SetBrightness(uint8_t b);
   uint8_t brightness() { return brightness_; }
 
   void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
 
+  // See FrameCanvas::SetScrollOffset()
+  void SetOutputOffset(int column);
+  int output_offset() const { return output_offset_; }
+  int output_columns() const { return output_columns_; }
+
+  // The pixel mapping this framebuffer draws with.
+  PixelDesignatorMap *mapper() const { return *shared_mapper_; }
+
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
+  // Like Deserialize(), but use "data" in place instead of copying it.
+  // See FrameCanvas::DeserializeNoCopy().
+  bool DeserializeNoCopy(const char *data, size_t len);
+  // See FrameCanvas::SerializeActivePlanes()
+  size_t SerializeActivePlanes(char *data, size_t len,
+                               uint8_t *pwm_bits) const;
+  bool DeserializeActivePlanes(const char *data, size_t len,
+                               uint8_t pwm_bits);
   void CopyFrom(const Framebuffer *other);
+  // See FrameCanvas::CopyRect()
+  void CopyRect(const Framebuffer *src, int src_x, int src_y,
+                int width, int height, int dst_x, int dst_y);
 
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  // See FrameCanvas::SetPixels()
+  void SetPixels(int x, int y, int width, int height,
+                 const uint8_t *rgb, int stride);
+  // See FrameCanvas::SetIndexedPixels()
+  void SetIndexedPixels(int x, int y, int width, int height,
+                        const uint8_t *indexes, int stride,
+                        const uint8_t *palette_rgb, int palette_size,
+                        int transparent_index);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  void FillRect(int x, int y, int width, int height,
+                uint8_t red, uint8_t green, uint8_t blue);
+
+  // Size of the un-mapped arrangement of panels, i.e. before any
+  // PixelMapper is applied.
+  int physical_width() const { return columns_; }
+  int physical_height() const { return height_; }
+
+  // Inverse of the default designator set up for the first PixelDesignatorMap:
+  // the physical position of the LED that "designator" writes to.
+  // Returns false if it doesn't address any LED.
+  bool GetPhysicalPosition(const PixelDesignator &designator,
+                           int *x, int *y) const;
 
 private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
 
+  // The refresh loop is instantiated for each combination of scan mode and
+  // RowAddressSetter implementation, so that the per-column loop does not
+  // have to decide anything at runtime. The right one is chosen in InitGPIO().
+  typedef void (Framebuffer::*DumpFunction)(GPIO *io, int pwm_low_bit);
+  static DumpFunction dump_function_;
+  static gpio_bits_t color_clk_mask_;  // Mask of bits while clocking in.
+
+  static DumpFunction SelectDumpFunction(int scan_mode, int row_address_type);
+
+  void Init(const char *led_sequence);
+  template <int scan_mode, class RowSetter>
+  void DumpToMatrixKernel(GPIO *io, int pwm_low_bit);
+
   // This returns the gpio-bit for given color (one of 'R', 'G', 'B'). This is
   // returning the right value in case "led_sequence" is _not_ "RGB"
   static gpio_bits_t GetGpioFromLedSequence(char col, const char *led_sequence,
@@ -121,21 +203,35 @@ private:
                                             gpio_bits_t default_g,
                                             gpio_bits_t default_b);
 
-  void InitDefaultDesignator(int x, int y, const char *led_sequence,
+  class DefaultDesignatorFunction;
+
+  // Bits of the sub-panels, indexed by [parallel_chain * 2 + lower_half],
+  // already permuted by the led sequence.
+  typedef PixelDesignator SubPanelBits[3 * 2];
+  void InitSubPanelBits(const char *led_sequence, SubPanelBits *bits) const;
+  void InitDefaultDesignator(int x, int y, const SubPanelBits &bits,
                              PixelDesignator *designator);
+  static const ColorLookup *GetColorLookup(uint8_t brightness,
+                                           bool luminance_correct,
+                                           bool inverse_color);
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
   const int columns_;  // Number of columns. Number of chained boards * 32.
+  const int output_columns_;  // Columns clocked out; less when scrolling.
+  // First column clocked out. Set while the refresh thread reads it, which
+  // only does so once per frame.
+  volatile int output_offset_;
 
-  const int scan_mode_;
   const bool inverse_color_;
 
   uint8_t pwm_bits_;   // PWM bits to display.
   bool do_luminance_correct_;
   uint8_t brightness_;
+  // Bit planes of each channel value with the settings above; shared.
+  const ColorLookup *color_lookup_;
 
   const int double_rows_;
   const size_t buffer_size_;
@@ -146,10 +242,17 @@ private:
   // Each bitplane-column is pre-filled IoBits, of which the colors are set.
   // Of course, that means that we store unrelated bits in the frame-buffer,
   // but it allows easy access in the critical section.
+  //
+  // Usually bitplane_buffer_ is our own_buffer_, but after DeserializeNoCopy()
+  // it points to read-only data owned by someone else. Everything that
+  // modifies the frame needs to call UseOwnBuffer() first.
   gpio_bits_t *bitplane_buffer_;
+  gpio_bits_t *own_buffer_;
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
+  inline void UseOwnBuffer(bool keep_content);
 
-  PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
+  PixelDesignatorMap *own_mapper_;  // Only for output_columns_ < columns_.
+  PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix or own_mapper_.
 };
 }  // namespace internal
 }  // namespace rgb_matrix
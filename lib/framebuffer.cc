@@ -26,10 +26,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <string>
+#include <vector>
 
 #include "gpio.h"
+#include "thread.h"
 
 namespace rgb_matrix {
 namespace internal {
@@ -47,12 +51,6 @@ static PinPulser *sOutputEnablePulser = NULL;
 #  define SUB_PANELS_ 2
 #endif
 
-PixelDesignator *PixelDesignatorMap::get(int x, int y) {
-  if (x < 0 || y < 0 || x >= width_ || y >= height_)
-    return NULL;
-  return buffer_ + (y*width_) + x;
-}
-
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
                                        const PixelDesignator &fill_bits)
   : width_(width), height_(height), fill_bits_(fill_bits),
@@ -63,6 +61,71 @@ PixelDesignatorMap::~PixelDesignatorMap() {
   delete [] buffer_;
 }
 
+namespace {
+// Don't bother starting threads for less than about a 64x64 panel worth of
+// pixels each; thread start-up would cost more than it saves.
+static const int kMinPixelsPerThread = 64 * 64;
+
+class RowRangeThread : public Thread {
+public:
+  RowRangeThread(RowRangeFunction *work, int y_start, int y_end)
+    : work_(work), y_start_(y_start), y_end_(y_end) {}
+
+  virtual void Run() { work_->ProcessRows(y_start_, y_end_); }
+
+private:
+  RowRangeFunction *const work_;
+  const int y_start_;
+  const int y_end_;
+};
+}  // anonymous namespace
+
+void ProcessRowsInParallel(int width, int height, RowRangeFunction *work) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = std::min(threads, (width * height) / kMinPixelsPerThread);
+  threads = std::min(threads, height);
+  if (threads <= 1) {
+    work->ProcessRows(0, height);
+    return;
+  }
+
+  // The calling thread does the first range itself.
+  std::vector<RowRangeThread*> workers;
+  const int rows_per_thread = (height + threads - 1) / threads;
+  for (int y = rows_per_thread; y < height; y += rows_per_thread) {
+    RowRangeThread *t = new RowRangeThread(
+      work, y, std::min(y + rows_per_thread, height));
+    t->Start();
+    workers.push_back(t);
+  }
+  work->ProcessRows(0, rows_per_thread);
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->WaitStopped();  // Before ~RowRangeThread() takes away Run()
+    delete workers[i];
+  }
+}
+
+// Sets up the default designators of the first PixelDesignatorMap.
+class Framebuffer::DefaultDesignatorFunction : public RowRangeFunction {
+public:
+  DefaultDesignatorFunction(Framebuffer *fb, const SubPanelBits &bits,
+                            PixelDesignatorMap *map)
+    : fb_(fb), bits_(bits), map_(map) {}
+
+  virtual void ProcessRows(int y_start, int y_end) {
+    for (int y = y_start; y < y_end; ++y) {
+      for (int x = 0; x < map_->width(); ++x) {
+        fb_->InitDefaultDesignator(x, y, bits_, map_->get(x, y));
+      }
+    }
+  }
+
+private:
+  Framebuffer *const fb_;
+  const SubPanelBits &bits_;
+  PixelDesignatorMap *const map_;
+};
+
 // Different panel types use different techniques to set the row address.
 // We abstract that away with different implementations of RowAddressSetter
 class RowAddressSetter {
@@ -192,34 +255,59 @@ private:
 
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
+Framebuffer::DumpFunction Framebuffer::dump_function_ = NULL;
+gpio_bits_t Framebuffer::color_clk_mask_ = 0;
 
 Framebuffer::Framebuffer(int rows, int columns, int parallel,
-                         int scan_mode,
                          const char *led_sequence, bool inverse_color,
                          PixelDesignatorMap **mapper)
   : rows_(rows),
     parallel_(parallel),
     height_(rows * parallel),
-    columns_(columns),
-    scan_mode_(scan_mode),
+    columns_(columns), output_columns_(columns), output_offset_(0),
+    inverse_color_(inverse_color),
+    pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    color_lookup_(NULL),
+    double_rows_(rows / SUB_PANELS_),
+    buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
+    own_mapper_(NULL), shared_mapper_(mapper) {
+  Init(led_sequence);
+}
+
+Framebuffer::Framebuffer(int rows, int columns, int output_columns,
+                         int parallel,
+                         const char *led_sequence, bool inverse_color)
+  : rows_(rows),
+    parallel_(parallel),
+    height_(rows * parallel),
+    columns_(columns), output_columns_(output_columns), output_offset_(0),
     inverse_color_(inverse_color),
     pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    color_lookup_(NULL),
     double_rows_(rows / SUB_PANELS_),
     buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
-    shared_mapper_(mapper) {
+    own_mapper_(NULL), shared_mapper_(&own_mapper_) {
+  assert(output_columns_ <= columns_);
+  Init(led_sequence);
+}
+
+void Framebuffer::Init(const char *led_sequence) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
   assert(rows_ >=4 && rows_ <= 64 && rows_ % 2 == 0);
-  if (parallel > hardware_mapping_->max_parallel_chains) {
+  if (parallel_ > hardware_mapping_->max_parallel_chains) {
     fprintf(stderr, "The %s GPIO mapping only supports %d parallel chain%s, "
             "but %d was requested.\n", hardware_mapping_->name,
             hardware_mapping_->max_parallel_chains,
-            hardware_mapping_->max_parallel_chains > 1 ? "s" : "", parallel);
+            hardware_mapping_->max_parallel_chains > 1 ? "s" : "", parallel_);
     abort();
   }
-  assert(parallel >= 1 && parallel <= 3);
+  assert(parallel_ >= 1 && parallel_ <= 3);
 
-  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  own_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  bitplane_buffer_ = own_buffer_;
+  color_lookup_ = GetColorLookup(brightness_, do_luminance_correct_,
+                                 inverse_color_);
 
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
@@ -242,23 +330,67 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     fill_bits.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
 
     *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits);
-    for (int y = 0; y < height_; ++y) {
-      for (int x = 0; x < columns_; ++x) {
-        InitDefaultDesignator(x, y, led_sequence, (*shared_mapper_)->get(x, y));
-      }
-    }
+    SubPanelBits sub_panel_bits;
+    InitSubPanelBits(led_sequence, &sub_panel_bits);
+    DefaultDesignatorFunction init(this, sub_panel_bits, *shared_mapper_);
+    ProcessRowsInParallel(columns_, height_, &init);
   }
 
   Clear();
 }
 
 Framebuffer::~Framebuffer() {
-  delete [] bitplane_buffer_;
+  delete [] own_buffer_;
+  delete own_mapper_;
+}
+
+void Framebuffer::SetOutputOffset(int column) {
+  output_offset_ = std::max(0, std::min(column, columns_ - output_columns_));
+}
+
+// Address lines the row address setter of "row_address_type" uses for
+// panels with "rows".
+static int AddressLinesNeeded(int rows, int row_address_type) {
+  if (row_address_type == 1) return 2;  // Shift register: clock and data.
+  if (row_address_type == 2) return 4;  // One line per row, A..D.
+  int lines = 0;
+  while ((1 << lines) < rows / SUB_PANELS_) ++lines;
+  return lines;
+}
+
+// Parse a custom hardware mapping given either inline as "{...}" pin
+// description or as the name of a file containing one.
+// Returns NULL if this is neither.
+static struct HardwareMapping *ParseCustomHardwareMapping(
+  const char *spec, int address_lines) {
+  static struct HardwareMapping custom_mapping;
+  std::string content;
+  if (spec[0] == '{') {
+    content = spec;
+  } else {
+    FILE *f = fopen(spec, "r");
+    if (f == NULL) return NULL;
+    char buf[1024];
+    size_t r;
+    while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+      content.append(buf, r);
+    }
+    fclose(f);
+  }
+  char err[256];
+  if (!parse_hardware_mapping(content.c_str(), GPIO::kValidBits,
+                              address_lines, &custom_mapping,
+                              err, sizeof(err))) {
+    if (spec[0] != '{') fprintf(stderr, "%s: ", spec);
+    fprintf(stderr, "%s", err);
+    abort();
+  }
+  return &custom_mapping;
 }
 
-// TODO: this should also be parsed from some special formatted string, e.g.
-// {addr={22,23,24,25,15},oe=18,clk=17,strobe=4, p0={11,27,7,8,9,10},...}
-/* static */ void Framebuffer::InitHardwareMapping(const char *named_hardware) {
+/* static */ void Framebuffer::InitHardwareMapping(const char *named_hardware,
+                                                   int rows,
+                                                   int row_address_type) {
   if (named_hardware == NULL || *named_hardware == '\0') {
     named_hardware = "regular";
   }
@@ -272,8 +404,13 @@ Framebuffer::~Framebuffer() {
   }
 
   if (!mapping) {
-    fprintf(stderr, "There is no hardware mapping named '%s'.\nAvailable: ",
-            named_hardware);
+    mapping = ParseCustomHardwareMapping(
+      named_hardware, AddressLinesNeeded(rows, row_address_type));
+  }
+
+  if (!mapping) {
+    fprintf(stderr, "There is no hardware mapping named '%s' and it is not "
+            "a {...} pin description or file.\nAvailable: ", named_hardware);
     for (HardwareMapping *it = matrix_hardware_mappings; it->name; ++it) {
       if (it != matrix_hardware_mappings) fprintf(stderr, ", ");
       fprintf(stderr, "'%s'", it->name);
@@ -299,7 +436,8 @@ Framebuffer::~Framebuffer() {
                                         bool allow_hardware_pulsing,
                                         int pwm_lsb_nanoseconds,
                                         int dither_bits,
-                                        int row_address_type) {
+                                        int row_address_type,
+                                        int scan_mode) {
   if (sOutputEnablePulser != NULL)
     return;  // already initialized.
 
@@ -334,6 +472,16 @@ Framebuffer::~Framebuffer() {
 
   all_used_bits |= row_setter_->need_bits();
 
+  color_clk_mask_ = h.clock;
+  color_clk_mask_ |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
+  if (parallel >= 2) {
+    color_clk_mask_ |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
+  }
+  if (parallel >= 3) {
+    color_clk_mask_ |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
+  }
+  dump_function_ = SelectDumpFunction(scan_mode, row_address_type);
+
   // Adafruit HAT identified by the same prefix.
   const bool is_some_adafruit_hat = (0 == strncmp(h.name, "adafruit-hat",
                                                   strlen("adafruit-hat")));
@@ -352,6 +500,11 @@ Framebuffer::~Framebuffer() {
                                           bitplane_timings);
 }
 
+/* static */ void Framebuffer::SetOutputScale(float scale) {
+  if (sOutputEnablePulser != NULL)
+    sOutputEnablePulser->SetTimingScale(scale);
+}
+
 bool Framebuffer::SetPWMBits(uint8_t value) {
   if (value < 1 || value > kBitPlanes)
     return false;
@@ -365,10 +518,17 @@ inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
                             + column ];
 }
 
+inline void Framebuffer::UseOwnBuffer(bool keep_content) {
+  if (bitplane_buffer_ == own_buffer_) return;
+  if (keep_content) memcpy(own_buffer_, bitplane_buffer_, buffer_size_);
+  bitplane_buffer_ = own_buffer_;
+}
+
 void Framebuffer::Clear() {
   if (inverse_color_) {
     Fill(0, 0, 0);
   } else  {
+    UseOwnBuffer(false);
     // Cheaper.
     memset(bitplane_buffer_, 0,
            sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
@@ -382,57 +542,75 @@ static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
   return out_factor * ((v <= 8) ? v / 902.3 : pow((v + 16) / 116.0, 3));
 }
 
+// Non luminance correction. TODO: consider getting rid of this.
+static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
+  // simple scale down the color value
+  c = c * brightness / 100;
+
+  enum {shift = kBitPlanes - 8};  //constexpr; shift to be left aligned.
+  return (shift > 0) ? (c << shift) : (c >> -shift);
+}
+
+// The bit planes of each channel value. For SetPixel(), also spread out so
+// that bit plane p is at bit 3*p: the red, green and blue bits of a plane
+// then are next to each other, after shifting the green by one and the blue
+// by two.
 struct ColorLookup {
   uint16_t color[256];
+  uint64_t spread[256];
 };
-static ColorLookup *CreateLuminanceCIE1931LookupTable() {
-  ColorLookup *for_brightness = new ColorLookup[100];
-  for (int c = 0; c < 256; ++c)
-    for (int b = 0; b < 100; ++b)
-      for_brightness[b].color[c] = luminance_cie1931(c, b + 1);
 
-  return for_brightness;
+/* static */ const ColorLookup *Framebuffer::GetColorLookup(
+  uint8_t brightness, bool luminance_correct, bool inverse_color) {
+  // Built on first use of each combination; the framebuffers with the same
+  // settings share it. Never freed.
+  static Mutex mutex;
+  static ColorLookup *lookups[2][2][100];
+  MutexLock l(&mutex);
+  ColorLookup *&lookup
+    = lookups[luminance_correct][inverse_color][brightness - 1];
+  if (lookup == NULL) {
+    lookup = new ColorLookup();
+    for (int c = 0; c < 256; ++c) {
+      uint16_t value = luminance_correct
+        ? luminance_cie1931(c, brightness)
+        : DirectMapColor(brightness, c);
+      lookup->color[c] = inverse_color ? ~value : value;
+      lookup->spread[c] = 0;
+      for (int b = 0; b < kBitPlanes; ++b) {
+        if (lookup->color[c] & (1 << b))
+          lookup->spread[c] |= 1ULL << (3 * b);
+      }
+    }
+  }
+  return lookup;
 }
 
-static inline uint16_t CIEMapColor(uint8_t brightness, uint8_t c) {
-  static ColorLookup *luminance_lookup = CreateLuminanceCIE1931LookupTable();
-  return luminance_lookup[brightness - 1].color[c];
+void Framebuffer::set_luminance_correct(bool on) {
+  do_luminance_correct_ = on;
+  color_lookup_ = GetColorLookup(brightness_, do_luminance_correct_,
+                                 inverse_color_);
 }
 
-// Non luminance correction. TODO: consider getting rid of this.
-static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
-  // simple scale down the color value
-  c = c * brightness / 100;
-
-  enum {shift = kBitPlanes - 8};  //constexpr; shift to be left aligned.
-  return (shift > 0) ? (c << shift) : (c >> -shift);
+void Framebuffer::SetBrightness(uint8_t b) {
+  brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
+  color_lookup_ = GetColorLookup(brightness_, do_luminance_correct_,
+                                 inverse_color_);
 }
 
 inline void Framebuffer::MapColors(
   uint8_t r, uint8_t g, uint8_t b,
   uint16_t *red, uint16_t *green, uint16_t *blue) {
-
-  if (do_luminance_correct_) {
-    *red   = CIEMapColor(brightness_, r);
-    *green = CIEMapColor(brightness_, g);
-    *blue  = CIEMapColor(brightness_, b);
-  } else {
-    *red   = DirectMapColor(brightness_, r);
-    *green = DirectMapColor(brightness_, g);
-    *blue  = DirectMapColor(brightness_, b);
-  }
-
-  if (inverse_color_) {
-    *red = ~(*red);
-    *green = ~(*green);
-    *blue = ~(*blue);
-  }
+  *red   = color_lookup_->color[r];
+  *green = color_lookup_->color[g];
+  *blue  = color_lookup_->color[b];
 }
 
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
   const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
+  UseOwnBuffer(true);  // Planes beyond pwm_bits_ are kept.
 
   for (int b = kBitPlanes - pwm_bits_; b < kBitPlanes; ++b) {
     uint16_t mask = 1 << b;
@@ -450,32 +628,164 @@ void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   }
 }
 
+void Framebuffer::FillRect(int x, int y, int width, int height,
+                           uint8_t r, uint8_t g, uint8_t b) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  if (x < 0) { width += x; x = 0; }
+  if (y < 0) { height += y; y = 0; }
+  if (x + width > map->width()) width = map->width() - x;
+  if (y + height > map->height()) height = map->height() - y;
+  if (width <= 0 || height <= 0) return;
+
+  // The color is the same everywhere, so which of red, green, blue is on is
+  // only decided once per bit plane.
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  uint32_t red_on[kBitPlanes], green_on[kBitPlanes], blue_on[kBitPlanes];
+  for (int p = 0; p < pwm_bits_; ++p) {
+    const uint16_t mask = 1 << (min_bit_plane + p);
+    red_on[p]   = (red & mask)   ? ~0u : 0;
+    green_on[p] = (green & mask) ? ~0u : 0;
+    blue_on[p]  = (blue & mask)  ? ~0u : 0;
+  }
+
+  UseOwnBuffer(true);
+  uint32_t *const first_plane = bitplane_buffer_ + columns_ * min_bit_plane;
+  for (int row = y; row < y + height; ++row) {
+    const PixelDesignator *d = map->get(x, row);
+    const PixelDesignator *const end = d + width;
+    while (d < end) {
+      if (d->gpio_word < 0) { ++d; continue; }  // non-used pixel marker.
+      // Without a pixel mapper that reorders columns, neighbouring pixels
+      // are neighbouring words with the same bits; such a run is written
+      // plane by plane in one go.
+      const PixelDesignator *run_end = d + 1;
+      while (run_end < end
+             && run_end->gpio_word == run_end[-1].gpio_word + 1
+             && run_end->r_bit == d->r_bit && run_end->g_bit == d->g_bit
+             && run_end->b_bit == d->b_bit && run_end->mask == d->mask) {
+        ++run_end;
+      }
+      const int run = run_end - d;
+      const uint32_t designator_mask = d->mask;
+      uint32_t *bits = first_plane + d->gpio_word;
+      for (int p = 0; p < pwm_bits_; ++p, bits += columns_) {
+        const uint32_t color_bits = (d->r_bit & red_on[p])
+          | (d->g_bit & green_on[p]) | (d->b_bit & blue_on[p]);
+        for (int i = 0; i < run; ++i) {
+          bits[i] = (bits[i] & designator_mask) | color_bits;
+        }
+      }
+      d = run_end;
+    }
+  }
+}
+
 int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
+// Three bits per bit plane: blue, green, red. See ColorLookup.
+static inline uint64_t RGBPlanes(const uint64_t *spread,
+                                 uint8_t r, uint8_t g, uint8_t b) {
+  return spread[r] | (spread[g] << 1) | (spread[b] << 2);
+}
+
+// Write the lowest "planes" bit planes of "rgb_planes" to the pixel; the
+// planes in "first_plane" are "columns" apart.
+static inline void WritePlanes(const PixelDesignator &designator,
+                               uint64_t rgb_planes, int planes, int columns,
+                               gpio_bits_t *first_plane) {
+  // The gpio bits of each red, green, blue combination.
+  const gpio_bits_t r_bits = designator.r_bit;
+  const gpio_bits_t g_bits = designator.g_bit;
+  const gpio_bits_t b_bits = designator.b_bit;
+  const gpio_bits_t color_bits[8] = {
+    0, r_bits, g_bits, r_bits | g_bits,
+    b_bits, r_bits | b_bits, g_bits | b_bits, r_bits | g_bits | b_bits };
+  const gpio_bits_t designator_mask = designator.mask;
+  gpio_bits_t *bits = first_plane + designator.gpio_word;
+  for (int p = 0; p < planes; ++p, bits += columns, rgb_planes >>= 3) {
+    *bits = (*bits & designator_mask) | color_bits[rgb_planes & 7];
+  }
+}
+
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
   const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
   if (designator == NULL) return;
-  const int pos = designator->gpio_word;
-  if (pos < 0) return;  // non-used pixel marker.
+  if (designator->gpio_word < 0) return;  // non-used pixel marker.
 
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+  UseOwnBuffer(true);
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  WritePlanes(*designator,
+              RGBPlanes(color_lookup_->spread, r, g, b) >> (3 * min_bit_plane),
+              pwm_bits_, columns_, bitplane_buffer_ + columns_ * min_bit_plane);
+}
 
-  uint32_t *bits = bitplane_buffer_ + pos;
+void Framebuffer::SetPixels(int x, int y, int width, int height,
+                            const uint8_t *rgb, int stride) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  // Clip to the canvas.
+  if (x < 0) { rgb -= 3 * x; width += x; x = 0; }
+  if (y < 0) { rgb -= stride * y; height += y; y = 0; }
+  if (x + width > map->width()) width = map->width() - x;
+  if (y + height > map->height()) height = map->height() - y;
+  if (width <= 0 || height <= 0) return;
+
+  const uint64_t *const spread = color_lookup_->spread;
+  UseOwnBuffer(true);
   const int min_bit_plane = kBitPlanes - pwm_bits_;
-  bits += (columns_ * min_bit_plane);
-  const uint32_t r_bits = designator->r_bit;
-  const uint32_t g_bits = designator->g_bit;
-  const uint32_t b_bits = designator->b_bit;
-  const uint32_t designator_mask = designator->mask;
-  for (uint16_t mask = 1<<min_bit_plane; mask != 1<<kBitPlanes; mask <<=1 ) {
-    uint32_t color_bits = 0;
-    if (red & mask)   color_bits |= r_bits;
-    if (green & mask) color_bits |= g_bits;
-    if (blue & mask)  color_bits |= b_bits;
-    *bits = (*bits & designator_mask) | color_bits;
-    bits += columns_;
+  const int planes = pwm_bits_;
+  const int columns = columns_;
+  gpio_bits_t *const first_plane = bitplane_buffer_ + columns * min_bit_plane;
+  for (int row = 0; row < height; ++row, rgb += stride) {
+    const PixelDesignator *designator = map->get(x, y + row);
+    const uint8_t *pixel = rgb;
+    for (int col = 0; col < width; ++col, ++designator, pixel += 3) {
+      if (designator->gpio_word < 0) continue;  // non-used pixel marker.
+      WritePlanes(*designator,
+                  RGBPlanes(spread, pixel[0], pixel[1], pixel[2])
+                  >> (3 * min_bit_plane),
+                  planes, columns, first_plane);
+    }
+  }
+}
+
+void Framebuffer::SetIndexedPixels(int x, int y, int width, int height,
+                                   const uint8_t *indexes, int stride,
+                                   const uint8_t *palette_rgb,
+                                   int palette_size, int transparent_index) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  if (x < 0) { indexes -= x; width += x; x = 0; }
+  if (y < 0) { indexes -= stride * y; height += y; y = 0; }
+  if (x + width > map->width()) width = map->width() - x;
+  if (y + height > map->height()) height = map->height() - y;
+  if (width <= 0 || height <= 0 || palette_size <= 0) return;
+  if (palette_size > 256) palette_size = 256;
+
+  // The bit planes of each palette color, as WritePlanes() takes them.
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const uint64_t *const spread = color_lookup_->spread;
+  uint64_t rgb_planes[256];
+  for (int i = 0; i < palette_size; ++i) {
+    const uint8_t *rgb = palette_rgb + 3 * i;
+    rgb_planes[i] = RGBPlanes(spread, rgb[0], rgb[1], rgb[2])
+      >> (3 * min_bit_plane);
+  }
+
+  UseOwnBuffer(true);
+  const int planes = pwm_bits_;
+  const int columns = columns_;
+  gpio_bits_t *const first_plane = bitplane_buffer_ + columns * min_bit_plane;
+  for (int row = 0; row < height; ++row, indexes += stride) {
+    const PixelDesignator *designator = map->get(x, y + row);
+    for (int col = 0; col < width; ++col, ++designator) {
+      const int index = indexes[col];
+      if (index == transparent_index || index >= palette_size) continue;
+      if (designator->gpio_word < 0) continue;  // non-used pixel marker.
+      WritePlanes(*designator, rgb_planes[index], planes, columns,
+                  first_plane);
+    }
   }
 }
 
@@ -500,47 +810,72 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
   return default_r;  // String too long, should've been caught earlier.
 }
 
-void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
-                                        PixelDesignator *d) {
+void Framebuffer::InitSubPanelBits(const char *seq, SubPanelBits *bits) const {
   const struct HardwareMapping &h = *hardware_mapping_;
-  uint32_t *bits = ValueAt(y % double_rows_, x, 0);
-  d->gpio_word = bits - bitplane_buffer_;
-  d->r_bit = d->g_bit = d->b_bit = 0;
-  if (y < rows_) {
-    if (y < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-    }
+  const gpio_bits_t panel_bits[3 * 2][3] = {
+    { h.p0_r1, h.p0_g1, h.p0_b1 }, { h.p0_r2, h.p0_g2, h.p0_b2 },
+    { h.p1_r1, h.p1_g1, h.p1_b1 }, { h.p1_r2, h.p1_g2, h.p1_b2 },
+    { h.p2_r1, h.p2_g1, h.p2_b1 }, { h.p2_r2, h.p2_g2, h.p2_b2 },
+  };
+  for (int i = 0; i < 3 * 2; ++i) {
+    const gpio_bits_t *p = panel_bits[i];
+    PixelDesignator *d = &(*bits)[i];
+    d->r_bit = GetGpioFromLedSequence('R', seq, p[0], p[1], p[2]);
+    d->g_bit = GetGpioFromLedSequence('G', seq, p[0], p[1], p[2]);
+    d->b_bit = GetGpioFromLedSequence('B', seq, p[0], p[1], p[2]);
+    d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
   }
-  else if (y >= rows_ && y < 2 * rows_) {
-    if (y - rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-    }
-  }
-  else {
-    if (y - 2*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+}
+
+void Framebuffer::InitDefaultDesignator(int x, int y, const SubPanelBits &bits,
+                                        PixelDesignator *d) {
+  uint32_t *word = ValueAt(y % double_rows_, x, 0);
+  const int chain = std::min(y / rows_, 2);
+  const int lower_half = (y - chain * rows_ < double_rows_) ? 0 : 1;
+  const PixelDesignator &b = bits[chain * 2 + lower_half];
+  d->gpio_word = word - bitplane_buffer_;
+  d->r_bit = b.r_bit;
+  d->g_bit = b.g_bit;
+  d->b_bit = b.b_bit;
+  d->mask = b.mask;
+}
+
+bool Framebuffer::GetPhysicalPosition(const PixelDesignator &d,
+                                      int *x, int *y) const {
+  const int row_stride = columns_ * kBitPlanes;
+  if (d.gpio_word < 0 || d.gpio_word >= double_rows_ * row_stride)
+    return false;
+  const int column = d.gpio_word % row_stride;
+  if (column >= columns_)
+    return false;
+
+  // Each chain has color bits for two sub-panels; builds that drive fewer
+  // only use the first ones. More than that we can't tell apart.
+  if (SUB_PANELS_ > 2)
+    return false;
+
+  // The led sequence only permutes the color bits of a sub-panel, so the
+  // union of them identifies it.
+  const struct HardwareMapping &h = *hardware_mapping_;
+  const gpio_bits_t sub_panel_bits[3][2] = {
+    { h.p0_r1 | h.p0_g1 | h.p0_b1,  h.p0_r2 | h.p0_g2 | h.p0_b2 },
+    { h.p1_r1 | h.p1_g1 | h.p1_b1,  h.p1_r2 | h.p1_g2 | h.p1_b2 },
+    { h.p2_r1 | h.p2_g1 | h.p2_b1,  h.p2_r2 | h.p2_g2 | h.p2_b2 },
+  };
+  const gpio_bits_t bits = d.r_bit | d.g_bit | d.b_bit;
+  if (bits == 0)
+    return false;
+  for (int chain = 0; chain < parallel_; ++chain) {
+    for (int sub_panel = 0; sub_panel < SUB_PANELS_; ++sub_panel) {
+      if (bits == sub_panel_bits[chain][sub_panel]) {
+        *x = column;
+        *y = chain * rows_ + sub_panel * double_rows_
+          + d.gpio_word / row_stride;
+        return *y < height_;
+      }
     }
   }
-
-  d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
+  return false;
 }
 
 void Framebuffer::Serialize(const char **data, size_t *len) const {
@@ -550,55 +885,196 @@ void Framebuffer::Serialize(const char **data, size_t *len) const {
 
 bool Framebuffer::Deserialize(const char *data, size_t len) {
   if (len != buffer_size_) return false;
+  UseOwnBuffer(false);
   memcpy(bitplane_buffer_, data, len);
   return true;
 }
 
+bool Framebuffer::DeserializeNoCopy(const char *data, size_t len) {
+  if ((uintptr_t)data % sizeof(gpio_bits_t) != 0)
+    return Deserialize(data, len);  // Can't use unaligned data directly.
+  if (len != buffer_size_) return false;
+  bitplane_buffer_ = reinterpret_cast<gpio_bits_t*>(const_cast<char*>(data));
+  return true;
+}
+
+// The planes used with pwm_bits_ are the upper ones, which are contiguous
+// within each double row.
+size_t Framebuffer::SerializeActivePlanes(char *data, size_t len,
+                                          uint8_t *pwm_bits) const {
+  const size_t row_bytes = pwm_bits_ * columns_ * sizeof(gpio_bits_t);
+  const size_t needed = double_rows_ * row_bytes;
+  *pwm_bits = pwm_bits_;
+  if (len < needed) return needed;
+  const gpio_bits_t *row_planes = bitplane_buffer_
+    + (kBitPlanes - pwm_bits_) * columns_;
+  for (int row = 0; row < double_rows_; ++row) {
+    memcpy(data, row_planes, row_bytes);
+    data += row_bytes;
+    row_planes += columns_ * kBitPlanes;
+  }
+  return needed;
+}
+
+bool Framebuffer::DeserializeActivePlanes(const char *data, size_t len,
+                                          uint8_t pwm_bits) {
+  if (pwm_bits < 1 || pwm_bits > kBitPlanes) return false;
+  const int min_bit_plane = kBitPlanes - pwm_bits;
+  const size_t row_bytes = pwm_bits * columns_ * sizeof(gpio_bits_t);
+  if (len != double_rows_ * row_bytes) return false;
+  UseOwnBuffer(false);
+  for (int row = 0; row < double_rows_; ++row) {
+    // Unused planes are zero, as if the frame was drawn with pwm_bits.
+    memset(ValueAt(row, 0, 0), 0,
+           min_bit_plane * columns_ * sizeof(gpio_bits_t));
+    memcpy(ValueAt(row, 0, min_bit_plane), data, row_bytes);
+    data += row_bytes;
+  }
+  return true;
+}
+
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
+  if (other->bitplane_buffer_ != other->own_buffer_) {
+    bitplane_buffer_ = other->bitplane_buffer_;  // Read-only, can share.
+    return;
+  }
+  UseOwnBuffer(false);
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
 }
 
+void Framebuffer::CopyRect(const Framebuffer *src, int src_x, int src_y,
+                           int width, int height, int dst_x, int dst_y) {
+  PixelDesignatorMap *const src_map = *src->shared_mapper_;
+  PixelDesignatorMap *const dst_map = *shared_mapper_;
+  // Clip to both canvases.
+  if (src_x < 0) { dst_x -= src_x; width += src_x; src_x = 0; }
+  if (src_y < 0) { dst_y -= src_y; height += src_y; src_y = 0; }
+  if (dst_x < 0) { src_x -= dst_x; width += dst_x; dst_x = 0; }
+  if (dst_y < 0) { src_y -= dst_y; height += dst_y; dst_y = 0; }
+  width = std::min(width, std::min(src_map->width() - src_x,
+                                   dst_map->width() - dst_x));
+  height = std::min(height, std::min(src_map->height() - src_y,
+                                     dst_map->height() - dst_y));
+  if (width <= 0 || height <= 0) return;
+
+  UseOwnBuffer(true);
+  // Writing the bitplanes could alias all that is read through pointers, so
+  // whatever is needed in the loops is copied to locals.
+  const int pwm_bits = pwm_bits_;
+  const int src_columns = src->columns_;
+  const int dst_columns = columns_;
+  const int min_bit_plane = kBitPlanes - pwm_bits;
+  const gpio_bits_t *const src_first_plane =
+    src->bitplane_buffer_ + src->columns_ * min_bit_plane;
+  gpio_bits_t *const dst_first_plane =
+    bitplane_buffer_ + columns_ * min_bit_plane;
+
+  // Within the same canvas, go in the direction that reads each pixel before
+  // it is overwritten, like memmove(). Then only single pixels are copied.
+  const bool overlapping = (src == this
+                            && abs(dst_x - src_x) < width
+                            && abs(dst_y - src_y) < height);
+  const bool rows_backwards = overlapping && dst_y > src_y;
+  const bool cols_backwards = overlapping && dst_y == src_y && dst_x > src_x;
+
+  for (int i = 0; i < height; ++i) {
+    const int row = rows_backwards ? height - 1 - i : i;
+    const PixelDesignator *const src_row = src_map->get(src_x, src_y + row);
+    const PixelDesignator *const dst_row = dst_map->get(dst_x, dst_y + row);
+    int col = 0;
+    while (col < width) {
+      const int c = cols_backwards ? width - 1 - col : col;
+      const PixelDesignator *s = src_row + c;
+      const PixelDesignator *d = dst_row + c;
+      if (d->gpio_word < 0) { ++col; continue; }  // non-used pixel marker.
+      gpio_bits_t *dst_bits = dst_first_plane + d->gpio_word;
+      const gpio_bits_t d_r = d->r_bit, d_g = d->g_bit, d_b = d->b_bit;
+      const gpio_bits_t d_mask = d->mask;
+      if (s->gpio_word < 0) {   // Nothing to see there: black.
+        for (int b = 0; b < pwm_bits; ++b, dst_bits += dst_columns) {
+          *dst_bits &= d_mask;
+        }
+        ++col;
+        continue;
+      }
+      const gpio_bits_t *src_bits = src_first_plane + s->gpio_word;
+      const gpio_bits_t s_r = s->r_bit, s_g = s->g_bit, s_b = s->b_bit;
+      if (s_r != d_r || s_g != d_g || s_b != d_b) {
+        // Different sub-panel: move each color bit to its new place.
+        for (int b = 0; b < pwm_bits; ++b) {
+          const gpio_bits_t value = *src_bits;
+          gpio_bits_t color_bits = 0;
+          if (value & s_r) color_bits |= d_r;
+          if (value & s_g) color_bits |= d_g;
+          if (value & s_b) color_bits |= d_b;
+          *dst_bits = (*dst_bits & d_mask) | color_bits;
+          src_bits += src_columns;
+          dst_bits += dst_columns;
+        }
+        ++col;
+        continue;
+      }
+
+      // Extend to neighbours in memory with the same bits on both sides.
+      int run = 1;
+      if (!overlapping) {
+        while (col + run < width
+               && s[run].gpio_word == s->gpio_word + run
+               && d[run].gpio_word == d->gpio_word + run
+               && s[run].r_bit == d_r && s[run].g_bit == d_g
+               && s[run].b_bit == d_b
+               && d[run].r_bit == d_r && d[run].g_bit == d_g
+               && d[run].b_bit == d_b) {
+          ++run;
+        }
+      }
+      for (int b = 0; b < pwm_bits; ++b) {
+        for (int k = 0; k < run; ++k) {
+          dst_bits[k] = (dst_bits[k] & d_mask) | (src_bits[k] & ~d_mask);
+        }
+        src_bits += src_columns;
+        dst_bits += dst_columns;
+      }
+      col += run;
+    }
+  }
+}
+
 void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
+  assert(dump_function_ != NULL);  // Called InitGPIO() ?
+  (this->*dump_function_)(io, pwm_low_bit);
+}
+
+template <int scan_mode, class RowSetter>
+void Framebuffer::DumpToMatrixKernel(GPIO *io, int pwm_low_bit) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
-  color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel_ >= 2) {
-    color_clk_mask |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
-  }
-  if (parallel_ >= 3) {
-    color_clk_mask |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
-  }
+  const gpio_bits_t color_clk_mask = color_clk_mask_;
 
-  color_clk_mask |= h.clock;
+  // We know the exact type, so the row address setting is not a virtual call.
+  RowSetter *const row_setter = static_cast<RowSetter*>(row_setter_);
 
   // Depending if we do dithering, we might not always show the lowest bits.
   const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
+  const int output_offset = output_offset_;  // Same for the whole frame.
 
-  const uint8_t half_double = double_rows_/2;
-  for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
-
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
-    }
+  const int half_double = double_rows_/2;
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    const int d_row = (scan_mode == 0)  // progressive
+      ? row_loop
+      : ((row_loop < half_double)       // interlaced
+         ? (row_loop << 1)
+         : ((row_loop - half_double) << 1) + 1);
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
     for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+      const gpio_bits_t *row_data = ValueAt(d_row, output_offset, b);
+      const gpio_bits_t *const row_end = row_data + output_columns_;
       // While the output enable is still on, we can already clock in the next
       // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
+      while (row_data != row_end) {
+        io->WriteMaskedBits(*row_data++, color_clk_mask);  // col + reset clock
         io->SetBits(h.clock);               // Rising edge: clock color in.
       }
       io->ClearBits(color_clk_mask);    // clock back to normal.
@@ -607,7 +1083,7 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
       sOutputEnablePulser->WaitPulseFinished();
 
       // Setting address and strobing needs to happen in dark time.
-      row_setter_->SetRowAddress(io, d_row);
+      row_setter->RowSetter::SetRowAddress(io, d_row);
 
       io->SetBits(h.strobe);   // Strobe in the previously clocked in row.
       io->ClearBits(h.strobe);
@@ -617,5 +1093,25 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
     }
   }
 }
+
+/* static */ Framebuffer::DumpFunction
+Framebuffer::SelectDumpFunction(int scan_mode, int row_address_type) {
+  switch (row_address_type) {
+  case 0:
+    return (scan_mode == 1)
+      ? &Framebuffer::DumpToMatrixKernel<1, DirectRowAddressSetter>
+      : &Framebuffer::DumpToMatrixKernel<0, DirectRowAddressSetter>;
+  case 1:
+    return (scan_mode == 1)
+      ? &Framebuffer::DumpToMatrixKernel<1, ShiftRegisterRowAddressSetter>
+      : &Framebuffer::DumpToMatrixKernel<0, ShiftRegisterRowAddressSetter>;
+  case 2:
+    return (scan_mode == 1)
+      ? &Framebuffer::DumpToMatrixKernel<1, DirectABCDLineRowAddressSetter>
+      : &Framebuffer::DumpToMatrixKernel<0, DirectABCDLineRowAddressSetter>;
+  }
+  assert(0);  // unexpected type.
+  return NULL;
+}
 }  // namespace internal
 }  // namespace rgb_matrix
@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -320,18 +321,28 @@ class TimerBasedPinPulser : public PinPulser {
 public:
   TimerBasedPinPulser(GPIO *io, uint32_t bits,
                       const std::vector<int> &nano_specs)
-    : io_(io), bits_(bits), nano_specs_(nano_specs) {}
+    : io_(io), bits_(bits), nano_specs_(nano_specs),
+      scaled_specs_(nano_specs) {}
 
   virtual void SendPulse(int time_spec_number) {
+    const long nanos = scaled_specs_[time_spec_number];
+    if (nanos <= 0) return;
     io_->ClearBits(bits_);
-    Timers::sleep_nanos(nano_specs_[time_spec_number]);
+    Timers::sleep_nanos(nanos);
     io_->SetBits(bits_);
   }
 
+  virtual void SetTimingScale(float scale) {
+    for (size_t i = 0; i < nano_specs_.size(); ++i) {
+      scaled_specs_[i] = lrintf(nano_specs_[i] * scale);
+    }
+  }
+
 private:
   GPIO *const io_;
   const uint32_t bits_;
   const std::vector<int> nano_specs_;
+  std::vector<int> scaled_specs_;
 };
 
 static bool LinuxHasModuleLoaded(const char *name) {
@@ -457,7 +468,7 @@ public:
   }
 
   HardwarePinPulser(uint32_t pins, const std::vector<int> &specs)
-    : triggered_(false) {
+    : specs_(specs), triggered_(false) {
     assert(CanHandle(pins));
 #if DEBUG_SLEEP_JITTER
     atexit(print_overshoot_histogram);
@@ -495,13 +506,46 @@ public:
     } else {
       assert(false); // should've been caught by CanHandle()
     }
-    InitPWMDivider((base/2) / PWM_BASE_TIME_NS);
+    full_divider_ = (base/2) / PWM_BASE_TIME_NS;
+    InitPWMDivider(full_divider_);
     for (size_t i = 0; i < specs.size(); ++i) {
-      pwm_range_.push_back(2 * specs[i] / base);
+      full_range_.push_back(2 * specs[i] / base);
+    }
+    pwm_range_ = full_range_;
+  }
+
+  virtual void SetTimingScale(float scale) {
+    // A slower PWM clock makes all pulses longer alike, so the binary weights
+    // stay exact, in steps of 1 / divider. Below kMinScaledDivider that gets
+    // too coarse; there, all ranges are halved instead, which drops the
+    // planes that get shorter than the hardware can do (2).
+    float divider = full_divider_ * scale;
+    int shift = 0;
+    while (divider < kMinScaledDivider && divider * 2 <= full_divider_
+           && shift < 31) {
+      divider *= 2;
+      ++shift;
+    }
+    uint32_t new_divider = lrintf(divider);
+    if (new_divider < 1) new_divider = 1;
+    if (new_divider != divider_) {
+      WaitPulseFinished();
+      InitPWMDivider(new_divider);
+    }
+    for (size_t i = 0; i < full_range_.size(); ++i) {
+      uint32_t range = full_range_[i] >> shift;
+      if (range < 2) range = 0;
+      pwm_range_[i] = range;
+      sleep_hints_[i] = (int)((uint64_t)specs_[i] * range * new_divider
+                              / (full_range_[i] * full_divider_) / 1000)
+        - JitterAllowanceMicroseconds();
     }
   }
 
   virtual void SendPulse(int c) {
+    if (pwm_range_[c] == 0) {
+      return;   // Scaled down to nothing.
+    }
     if (pwm_range_[c] < 16) {
       s_PWM_registers[PWM_RNG1] = pwm_range_[c];
 
@@ -592,6 +636,7 @@ private:
 
   void InitPWMDivider(uint32_t divider) {
     assert(divider < (1<<12));  // we only have 12 bits.
+    divider_ = divider;
 
     s_PWM_registers[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_POLA1 | PWM_CTL_CLRF1;
 
@@ -611,7 +656,15 @@ private:
   }
 
 private:
-  std::vector<uint32_t> pwm_range_;
+  // Smallest PWM clock divider SetTimingScale() uses before it halves the
+  // ranges; keeps its steps at about 6% or finer.
+  static const uint32_t kMinScaledDivider = 16;
+
+  const std::vector<int> specs_;
+  uint32_t full_divider_;               // PWM clock divider at full scale.
+  uint32_t divider_;                    // Current one.
+  std::vector<uint32_t> full_range_;
+  std::vector<uint32_t> pwm_range_;     // full_range_ scaled.
   std::vector<int> sleep_hints_;
   volatile uint32_t *fifo_;
   uint32_t start_time_;
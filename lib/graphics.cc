@@ -16,6 +16,7 @@
 #include "graphics.h"
 #include "utf8-internal.h"
 #include <stdlib.h>
+#include <algorithm>
 #include <functional>
 
 namespace rgb_matrix {
@@ -30,6 +31,10 @@ int DrawText(Canvas *c, const Font &font,
              const char *utf8_text, int extra_spacing) {
   const int start_x = x;
   while (*utf8_text) {
+    if (x >= c->width() && extra_spacing >= 0) {
+      // Nothing of the rest can be visible any more.
+      return x - start_x + MeasureText(font, utf8_text, extra_spacing);
+    }
     const uint32_t cp = utf8_next_codepoint(utf8_text);
     x += font.DrawGlyph(c, x, y, color, background_color, cp);
     x += extra_spacing;
@@ -37,6 +42,18 @@ int DrawText(Canvas *c, const Font &font,
   return x - start_x;
 }
 
+int MeasureText(const Font &font, const char *utf8_text, int extra_spacing) {
+  int width = 0;
+  while (*utf8_text) {
+    const uint32_t cp = utf8_next_codepoint(utf8_text);
+    int advance = font.CharacterWidth(cp);
+    if (advance < 0) advance = font.CharacterWidth(0xFFFD);  // Replacement.
+    if (advance < 0) advance = 0;
+    width += advance + extra_spacing;
+  }
+  return width;
+}
+
 // There used to be a symbol without the optional extra_spacing parameter. Let's
 // define this here so that people linking against an old library will still
 // have their code usable. Now: 2017-06-04; can probably be removed in a couple
@@ -59,19 +76,31 @@ int VerticalDrawText(Canvas *c, const Font &font, int x, int y,
   return y - start_y;
 }
 
+// Sets the pixels at "x_a" and "x_b" in row "y", those that are on the canvas.
+static void SetPixelPair(Canvas *c, int width, int height,
+                         int x_a, int x_b, int y, const Color &color) {
+  if (y < 0 || y >= height) return;
+  if (x_a >= 0 && x_a < width) c->SetPixel(x_a, y, color.r, color.g, color.b);
+  if (x_b >= 0 && x_b < width) c->SetPixel(x_b, y, color.r, color.g, color.b);
+}
+
 void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
+  const int width = c->width();
+  const int height = c->height();
+  if (x0 + radius < 0 || x0 - radius >= width
+      || y0 + radius < 0 || y0 - radius >= height) {
+    return;  // Entirely off the canvas.
+  }
+
   int x = radius, y = 0;
   int radiusError = 1 - x;
 
   while (y <= x) {
-    c->SetPixel(x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, x + y0, color.r, color.g, color.b);
-    c->SetPixel(-x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(-y + x0, -x + y0, color.r, color.g, color.b);
-    c->SetPixel(x + x0, -y + y0, color.r, color.g, color.b);
-    c->SetPixel(y + x0, -x + y0, color.r, color.g, color.b);
+    // The eight octants, as pairs of points in the same row.
+    SetPixelPair(c, width, height, x0 - x, x0 + x, y0 + y, color);
+    SetPixelPair(c, width, height, x0 - x, x0 + x, y0 - y, color);
+    SetPixelPair(c, width, height, x0 - y, x0 + y, y0 + x, color);
+    SetPixelPair(c, width, height, x0 - y, x0 + y, y0 - x, color);
     y++;
     if (radiusError<0){
       radiusError += 2 * y + 1;
@@ -83,7 +112,23 @@ void DrawCircle(Canvas *c, int x0, int y0, int radius, const Color &color) {
 }
 
 void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
+  if (y0 == y1) {
+    DrawHLine(c, x0, x1, y0, color);
+    return;
+  }
+  const int width = c->width();
+  const int height = c->height();
+  // Lines entirely on one side of the canvas are rejected right away, as
+  // with the outcodes of Cohen-Sutherland. Otherwise, the walk along the
+  // longer axis is limited to the canvas and stops when the shorter axis
+  // leaves it; the pixels are the same as without clipping.
+  if ((x0 < 0 && x1 < 0) || (x0 >= width && x1 >= width)
+      || (y0 < 0 && y1 < 0) || (y0 >= height && y1 >= height)) {
+    return;
+  }
+
   int dy = y1 - y0, dx = x1 - x0, gradient, x, y, shift = 0x10;
+  bool entered = false;
 
   if (abs(dx) > abs(dy)) {
     // x variation is bigger than y variation
@@ -93,22 +138,49 @@ void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
     }
     gradient = (dy << shift) / dx ;
 
-    for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
-      c->SetPixel(x, y >> shift, color.r, color.g, color.b);
+    const int x_start = std::max(x0, 0);
+    const int x_end = std::min(x1, width - 1);
+    y = 0x8000 + (y0 << shift) + (x_start - x0) * gradient;
+    for (x = x_start; x <= x_end; ++x, y += gradient) {
+      const int py = y >> shift;
+      if (py < 0 || py >= height) {
+        if (entered) break;
+        continue;
+      }
+      entered = true;
+      c->SetPixel(x, py, color.r, color.g, color.b);
     }
-  } else if (dy != 0) {
+  } else {
     // y variation is bigger than x variation
     if (y1 < y0) {
       std::swap(x0, x1);
       std::swap(y0, y1);
     }
     gradient = (dx << shift) / dy;
-    for (y = y0 , x = 0x8000 + (x0 << shift); y <= y1; ++y, x += gradient) {
-      c->SetPixel(x >> shift, y, color.r, color.g, color.b);
+
+    const int y_start = std::max(y0, 0);
+    const int y_end = std::min(y1, height - 1);
+    x = 0x8000 + (x0 << shift) + (y_start - y0) * gradient;
+    for (y = y_start; y <= y_end; ++y, x += gradient) {
+      const int px = x >> shift;
+      if (px < 0 || px >= width) {
+        if (entered) break;
+        continue;
+      }
+      entered = true;
+      c->SetPixel(px, y, color.r, color.g, color.b);
     }
-  } else {
-    c->SetPixel(x0, y0, color.r, color.g, color.b);
   }
 }
 
+void DrawHLine(Canvas *c, int x0, int x1, int y, const Color &color) {
+  if (x1 < x0) std::swap(x0, x1);
+  c->FillRect(x0, y, x1 - x0 + 1, 1, color.r, color.g, color.b);
+}
+
+void FillRect(Canvas *c, int x, int y, int width, int height,
+              const Color &color) {
+  c->FillRect(x, y, width, height, color.r, color.g, color.b);
+}
+
 }//namespace
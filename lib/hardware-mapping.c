@@ -19,6 +19,11 @@
  */
 #include "hardware-mapping.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define GPIO_BIT(b) (1<<(b))
 
 struct HardwareMapping matrix_hardware_mappings[] = {
@@ -215,3 +220,191 @@ struct HardwareMapping matrix_hardware_mappings[] = {
 
   {0}
 };
+
+/*
+ * Parser for custom pin descriptions. Each signal is referenced by its
+ * name in the description (for error messages) and its field.
+ */
+struct SpecSignal {
+  const char *name;
+  gpio_bits_t *field;
+};
+
+struct SpecParser {
+  const char *start;
+  const char *pos;
+  gpio_bits_t valid_bits;
+  const char *pin_user[32];  /* Signal name using each pin so far. */
+  char *err;
+  size_t err_size;
+};
+
+static int spec_error(struct SpecParser *p, const char *msg, const char *arg) {
+  snprintf(p->err, p->err_size, "Hardware mapping, offset %d: %s%s\n",
+           (int)(p->pos - p->start), msg, arg ? arg : "");
+  return 0;
+}
+
+static void spec_skip_space(struct SpecParser *p) {
+  for (;;) {
+    while (isspace((unsigned char)*p->pos)) ++p->pos;
+    if (*p->pos != '#') return;
+    while (*p->pos && *p->pos != '\n') ++p->pos;
+  }
+}
+
+static int spec_consume(struct SpecParser *p, char c) {
+  spec_skip_space(p);
+  if (*p->pos != c) return 0;
+  ++p->pos;
+  return 1;
+}
+
+static int spec_identifier(struct SpecParser *p, char *buf, size_t len) {
+  size_t n = 0;
+  spec_skip_space(p);
+  while (isalnum((unsigned char)*p->pos) || *p->pos == '_' || *p->pos == '-') {
+    if (n + 1 >= len) return spec_error(p, "Name too long", NULL);
+    buf[n++] = *p->pos++;
+  }
+  buf[n] = '\0';
+  return n > 0 ? 1 : spec_error(p, "Expected a name", NULL);
+}
+
+/* Parses a single pin "17" or a list "{22,23,24}". Returns number of pins. */
+static int spec_pins(struct SpecParser *p, int *pins, int max_pins) {
+  const int is_list = spec_consume(p, '{');
+  int count = 0;
+  do {
+    char *end;
+    long pin;
+    spec_skip_space(p);
+    pin = strtol(p->pos, &end, 10);
+    if (end == p->pos) return spec_error(p, "Expected a GPIO number", NULL);
+    if (count >= max_pins) return spec_error(p, "Too many pins", NULL);
+    if (pin < 0 || pin > 31 || (p->valid_bits & (1u << pin)) == 0) {
+      char msg[16];
+      snprintf(msg, sizeof(msg), "%ld", pin);
+      return spec_error(p, "GPIO not usable on this board: ", msg);
+    }
+    pins[count++] = (int)pin;
+    p->pos = end;
+  } while (is_list && spec_consume(p, ','));
+  if (is_list && !spec_consume(p, '}'))
+    return spec_error(p, "Expected '}'", NULL);
+  return count;
+}
+
+static int spec_assign(struct SpecParser *p, const struct SpecSignal *signal,
+                       int pin) {
+  if (p->pin_user[pin] != NULL) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "GPIO %d used for '%s' and '%s'", pin,
+             p->pin_user[pin], signal->name);
+    return spec_error(p, msg, NULL);
+  }
+  p->pin_user[pin] = signal->name;
+  *signal->field |= GPIO_BIT(pin);
+  return 1;
+}
+
+int parse_hardware_mapping(const char *spec, gpio_bits_t valid_bits,
+                           int address_lines,
+                           struct HardwareMapping *m,
+                           char *err, size_t err_size) {
+  static char custom_name[64];
+  struct SpecParser parser;
+  struct SpecParser *const p = &parser;
+  char key[32];
+  char name[sizeof(custom_name)] = "custom";
+  int addr_count = 0;
+  int i;
+
+  memset(p, 0, sizeof(*p));
+  p->start = p->pos = spec;
+  p->valid_bits = valid_bits;
+  p->err = err;
+  p->err_size = err_size;
+
+  memset(m, 0, sizeof(*m));
+  const struct SpecSignal single[] = {
+    { "oe", &m->output_enable }, { "clk", &m->clock },
+    { "strobe", &m->strobe },
+  };
+  const struct SpecSignal addr[] = {
+    { "a", &m->a }, { "b", &m->b }, { "c", &m->c }, { "d", &m->d },
+    { "e", &m->e },
+  };
+  const struct SpecSignal panel[3][6] = {
+    { { "p0_r1", &m->p0_r1 }, { "p0_g1", &m->p0_g1 }, { "p0_b1", &m->p0_b1 },
+      { "p0_r2", &m->p0_r2 }, { "p0_g2", &m->p0_g2 }, { "p0_b2", &m->p0_b2 } },
+    { { "p1_r1", &m->p1_r1 }, { "p1_g1", &m->p1_g1 }, { "p1_b1", &m->p1_b1 },
+      { "p1_r2", &m->p1_r2 }, { "p1_g2", &m->p1_g2 }, { "p1_b2", &m->p1_b2 } },
+    { { "p2_r1", &m->p2_r1 }, { "p2_g1", &m->p2_g1 }, { "p2_b1", &m->p2_b1 },
+      { "p2_r2", &m->p2_r2 }, { "p2_g2", &m->p2_g2 }, { "p2_b2", &m->p2_b2 } },
+  };
+
+  if (!spec_consume(p, '{')) return spec_error(p, "Expected '{'", NULL);
+  do {
+    int pins[6];
+    int count;
+    if (!spec_identifier(p, key, sizeof(key))) return 0;
+    if (!spec_consume(p, '=')) return spec_error(p, "Expected '=' after ", key);
+
+    if (strcmp(key, "name") == 0) {
+      if (!spec_identifier(p, name, sizeof(name))) return 0;
+      continue;
+    }
+
+    if ((count = spec_pins(p, pins, 6)) == 0) return 0;
+    if (strcmp(key, "addr") == 0) {
+      if (m->a) return spec_error(p, "Given twice: ", key);
+      if (count > 5) return spec_error(p, "At most 5 address lines", NULL);
+      addr_count = count;
+      for (i = 0; i < count; ++i) {
+        if (!spec_assign(p, &addr[i], pins[i])) return 0;
+      }
+    }
+    else if (key[0] == 'p' && key[1] >= '0' && key[1] <= '2' && !key[2]) {
+      const struct SpecSignal *colors = panel[key[1] - '0'];
+      if (*colors[0].field) return spec_error(p, "Given twice: ", key);
+      if (count != 6)
+        return spec_error(p, "Need 6 pins r1,g1,b1,r2,g2,b2 for ", key);
+      for (i = 0; i < count; ++i) {
+        if (!spec_assign(p, &colors[i], pins[i])) return 0;
+      }
+    }
+    else {
+      const struct SpecSignal *signal = NULL;
+      for (i = 0; i < 3; ++i) {
+        if (strcmp(key, single[i].name) == 0) signal = &single[i];
+      }
+      if (signal == NULL) return spec_error(p, "Unknown signal ", key);
+      if (*signal->field) return spec_error(p, "Given twice: ", key);
+      /* Multiple pins are OR-ed, like the classic mappings do. */
+      for (i = 0; i < count; ++i) {
+        if (!spec_assign(p, signal, pins[i])) return 0;
+      }
+    }
+  } while (spec_consume(p, ','));
+  if (!spec_consume(p, '}')) return spec_error(p, "Expected ',' or '}'", NULL);
+  spec_skip_space(p);
+  if (*p->pos) return spec_error(p, "Unexpected text after '}'", NULL);
+
+  for (i = 0; i < 3; ++i) {
+    if (!*single[i].field) return spec_error(p, "Missing ", single[i].name);
+  }
+  if (!m->a) return spec_error(p, "Missing ", "addr");
+  if (!m->p0_r1) return spec_error(p, "Missing ", "p0");
+  if (addr_count < address_lines) {
+    snprintf(err, err_size, "Hardware mapping: addr has %d line%s, but the "
+             "panel rows need %d\n", addr_count, addr_count > 1 ? "s" : "",
+             address_lines);
+    return 0;
+  }
+
+  strcpy(custom_name, name);
+  m->name = custom_name;
+  m->max_parallel_chains = 0;  /* Determined from the given chains */
+  return 1;
+}
@@ -20,6 +20,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint32_t gpio_bits_t;  /* this should probably come from gpio.h */
@@ -46,6 +47,27 @@ struct HardwareMapping {
 
 extern struct HardwareMapping matrix_hardware_mappings[];
 
+/*
+ * Parse a hardware mapping from a textual pin description, e.g.
+ *
+ *   {name=weighbridge, addr={22,23,24,25,15}, oe=18, clk=17, strobe=4,
+ *    p0={11,27,7,8,9,10}, p1={12,5,6,19,13,20}}
+ *
+ * Values are GPIO numbers. "addr" lists the a..e row address lines,
+ * p0..p2 the r1,g1,b1,r2,g2,b2 color lines of each parallel chain.
+ * oe, clk and strobe, addr and p0 are required; whitespace and '#' comments
+ * up to the end of a line are ignored.
+ *
+ * Every pin needs to be set in "valid_bits" and may only be used once.
+ * "addr" needs at least "address_lines" pins.
+ * The name is kept in static storage, which the next call overwrites.
+ * Returns 1 on success. Otherwise returns 0 and writes a message to "err".
+ */
+int parse_hardware_mapping(const char *spec, gpio_bits_t valid_bits,
+                           int address_lines,
+                           struct HardwareMapping *result,
+                           char *err, size_t err_size);
+
 #ifdef  __cplusplus
 }  // extern C
 #endif
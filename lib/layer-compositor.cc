@@ -0,0 +1,208 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "layer-compositor.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+
+void LayerRect::Add(const LayerRect &other) {
+  if (other.empty()) return;
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  x0 = std::min(x0, other.x0);
+  y0 = std::min(y0, other.y0);
+  x1 = std::max(x1, other.x1);
+  y1 = std::max(y1, other.y1);
+}
+
+Layer::Layer(int width, int height)
+  : width_(width), height_(height), rgba_(new uint8_t[4 * width * height]),
+    visible_(true) {
+  memset(rgba_, 0, 4 * width_ * height_);
+}
+
+Layer::~Layer() {
+  delete [] rgba_;
+}
+
+bool Layer::Clip(int *x, int *y, int *width, int *height) const {
+  if (*x < 0) { *width += *x; *x = 0; }
+  if (*y < 0) { *height += *y; *y = 0; }
+  if (*x + *width > width_) *width = width_ - *x;
+  if (*y + *height > height_) *height = height_ - *y;
+  return *width > 0 && *height > 0;
+}
+
+void Layer::Changed(int x, int y, int width, int height, bool drawn) {
+  const LayerRect rect(x, y, x + width, y + height);
+  dirty_.Add(rect);
+  if (drawn) content_.Add(rect);
+}
+
+void Layer::SetPixelAlpha(int x, int y, uint8_t red, uint8_t green,
+                          uint8_t blue, uint8_t alpha) {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+  uint8_t *const pixel = rgba_ + 4 * (y * width_ + x);
+  pixel[0] = red;
+  pixel[1] = green;
+  pixel[2] = blue;
+  pixel[3] = alpha;
+  Changed(x, y, 1, 1, alpha != 0);
+}
+
+void Layer::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
+  SetPixelAlpha(x, y, red, green, blue, 255);
+}
+
+void Layer::Clear() {
+  if (content_.empty()) return;
+  memset(rgba_, 0, 4 * width_ * height_);
+  dirty_.Add(content_);
+  content_ = LayerRect();
+}
+
+void Layer::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  FillRect(0, 0, width_, height_, red, green, blue);
+}
+
+void Layer::FillRect(int x, int y, int width, int height,
+                     uint8_t red, uint8_t green, uint8_t blue) {
+  if (!Clip(&x, &y, &width, &height)) return;
+  for (int row = y; row < y + height; ++row) {
+    uint8_t *pixel = rgba_ + 4 * (row * width_ + x);
+    for (int col = 0; col < width; ++col, pixel += 4) {
+      pixel[0] = red;
+      pixel[1] = green;
+      pixel[2] = blue;
+      pixel[3] = 255;
+    }
+  }
+  Changed(x, y, width, height, true);
+}
+
+void Layer::ClearRect(int x, int y, int width, int height) {
+  if (!Clip(&x, &y, &width, &height)) return;
+  for (int row = y; row < y + height; ++row) {
+    memset(rgba_ + 4 * (row * width_ + x), 0, 4 * width);
+  }
+  Changed(x, y, width, height, false);
+}
+
+void Layer::SetVisible(bool visible) {
+  if (visible == visible_) return;
+  visible_ = visible;
+  dirty_.Add(content_);
+}
+
+LayerCompositor::LayerCompositor(int width, int height, int layer_count)
+  : width_(width), height_(height) {
+  for (int i = 0; i < layer_count; ++i) {
+    layers_.push_back(new Layer(width, height));
+  }
+}
+
+LayerCompositor::~LayerCompositor() {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    delete layers_[i];
+  }
+}
+
+// value / 255, rounded; exact for the sums of products of two bytes that
+// BlendRow() makes, which also leaves them room in 16 bits.
+static inline uint16_t Div255(uint16_t value) {
+  value += 128;
+  return (uint16_t)(value + (value >> 8)) >> 8;
+}
+
+// "count" pixels of "rgba" over the pixels "below", which have four bytes
+// as well; the fourth is don't care. Without branches, with the same layout
+// on both sides and in 16 bits, so that the compiler can vectorize it.
+static void BlendRow(const uint8_t *rgba, uint8_t *below, int count) {
+  for (int i = 0; i < count; ++i) {
+    const uint16_t alpha = rgba[4 * i + 3];
+    const uint16_t keep = 255 - alpha;
+    for (int c = 0; c < 4; ++c) {
+      below[4 * i + c] = Div255(rgba[4 * i + c] * alpha
+                                + below[4 * i + c] * keep);
+    }
+  }
+}
+
+void LayerCompositor::Blend(const LayerRect &rect, uint8_t *rgb, int stride) {
+  const int width = rect.x1 - rect.x0;
+  row_.resize(4 * width);
+  uint8_t *const row = &row_[0];
+  for (int y = rect.y0; y < rect.y1; ++y) {
+    memset(row, 0, 4 * width);
+    for (size_t i = 0; i < layers_.size(); ++i) {
+      const Layer *const layer = layers_[i];
+      const LayerRect &content = layer->content_;
+      if (!layer->visible_ || y < content.y0 || y >= content.y1)
+        continue;
+      const int x0 = std::max(rect.x0, content.x0);
+      const int x1 = std::min(rect.x1, content.x1);
+      if (x0 >= x1) continue;
+      BlendRow(layer->rgba_ + 4 * (y * layer->width_ + x0),
+               row + 4 * (x0 - rect.x0), x1 - x0);
+    }
+    uint8_t *out = rgb + (y - rect.y0) * stride;
+    for (int x = 0; x < width; ++x, out += 3) {
+      out[0] = row[4 * x + 0];
+      out[1] = row[4 * x + 1];
+      out[2] = row[4 * x + 2];
+    }
+  }
+}
+
+void LayerCompositor::Compose(FrameCanvas *canvas) {
+  LayerRect changed;
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    changed.Add(layers_[i]->dirty_);
+    layers_[i]->dirty_ = LayerRect();
+  }
+
+  LayerRect rect(0, 0, width_, height_);
+  bool known = false;
+  for (size_t i = 0; i < composed_.size(); ++i) {
+    if (composed_[i].canvas == canvas) {
+      rect = composed_[i].outdated;
+      rect.Add(changed);
+      composed_[i].outdated = LayerRect();
+      known = true;
+    } else {
+      composed_[i].outdated.Add(changed);
+    }
+  }
+  if (!known) {
+    ComposedCanvas composed = { canvas, LayerRect() };
+    composed_.push_back(composed);
+  }
+  if (rect.empty()) return;
+
+  const int width = rect.x1 - rect.x0;
+  const int height = rect.y1 - rect.y0;
+  blended_.resize(3 * width * height);
+  Blend(rect, &blended_[0], 3 * width);
+  canvas->SetPixels(rect.x0, rect.y0, width, height, &blended_[0], 3 * width);
+}
+
+}  // namespace rgb_matrix
@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <sys/time.h>
 
+#include <deque>
+
 #include "gpio.h"
 #include "thread.h"
 #include "framebuffer-internal.h"
@@ -54,15 +56,25 @@ uint32_t GetMicrosecondCounter();
 
 using namespace internal;
 
+int64_t GetPresentationClockMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 // Pump pixels to screen. Needs to be high priority real-time because jitter
 class RGBMatrix::UpdateThread : public Thread {
 public:
-  UpdateThread(GPIO *io, FrameCanvas *initial_frame,
-               int pwm_dither_bits, bool show_refresh)
-    : io_(io), show_refresh_(show_refresh), running_(true),
-      current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+  UpdateThread(GPIO *io, FrameCanvas *volatile *active_frame,
+               int pwm_dither_bits, bool show_refresh, float output_scale)
+    : io_(io), show_refresh_(show_refresh), active_frame_(active_frame),
+      running_(true), current_frame_(*active_frame), next_frame_(NULL),
+      requested_frame_multiple_(1),
+      current_presented_at_us_(GetPresentationClockMicros()),
+      output_scale_(output_scale), ramp_from_(output_scale),
+      ramp_to_(output_scale), ramp_start_us_(0), ramp_us_(0) {
     pthread_cond_init(&frame_done_, NULL);
+    pthread_cond_init(&presentation_changed_, NULL);
     pthread_cond_init(&input_change_, NULL);
     switch (pwm_dither_bits) {
     case 0:
@@ -97,6 +109,9 @@ public:
     uint32_t initial_holdoff_start = GetMicrosecondCounter();
     bool max_measure_enabled = false;
 
+    float output_scale = output_scale_;
+    Framebuffer::SetOutputScale(output_scale);
+
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
@@ -114,10 +129,17 @@ public:
           frame_count = 0;
           if (next_frame_ != NULL) {
             current_frame_ = next_frame_;
+            current_presented_at_us_ = GetPresentationClockMicros();
             next_frame_ = NULL;
           }
           pthread_cond_signal(&frame_done_);
         }
+        if (!presentation_queue_.empty()) PresentDueFrame();
+        if (output_scale_ != ramp_to_) AdvanceOutputRamp();
+        if (output_scale_ != output_scale) {
+          output_scale = output_scale_;
+          Framebuffer::SetOutputScale(output_scale);
+        }
       }
 
       // Read input bits.
@@ -160,6 +182,44 @@ public:
     return previous;
   }
 
+  void PresentAt(FrameCanvas *canvas, int64_t present_at_us) {
+    MutexLock l(&frame_sync_);
+    while (presentation_queue_.size() >= (size_t)kPresentationQueueSize) {
+      frame_sync_.WaitOn(&presentation_changed_);
+    }
+    Presentation p = { canvas, present_at_us };
+    presentation_queue_.push_back(p);
+  }
+
+  FrameCanvas *AwaitRetiredCanvas(int64_t *presented_at_us, int timeout_ms) {
+    MutexLock l(&frame_sync_);
+    const int64_t deadline_us = GetPresentationClockMicros()
+      + timeout_ms * 1000LL;
+    while (retired_.empty() && timeout_ms != 0) {
+      long wait_ms = -1;
+      if (timeout_ms > 0) {
+        wait_ms = (deadline_us - GetPresentationClockMicros()) / 1000;
+        if (wait_ms <= 0) break;
+      }
+      frame_sync_.WaitOn(&presentation_changed_, wait_ms);
+    }
+    if (retired_.empty()) return NULL;
+    const Presentation result = retired_.front();
+    retired_.pop_front();
+    if (presented_at_us) *presented_at_us = result.time_us;
+    return result.canvas;
+  }
+
+  // Change the output scale to "scale" over "ramp_ms", starting with the
+  // next refresh.
+  void SetOutputScale(float scale, int ramp_ms) {
+    MutexLock l(&frame_sync_);
+    ramp_from_ = output_scale_;
+    ramp_to_ = scale;
+    ramp_start_us_ = GetPresentationClockMicros();
+    ramp_us_ = ramp_ms * 1000LL;
+  }
+
   uint32_t AwaitInputChange(int timeout_ms) {
     MutexLock l(&input_sync_);
     input_sync_.WaitOn(&input_change_, timeout_ms);
@@ -167,14 +227,53 @@ public:
   }
 
 private:
+  struct Presentation {
+    FrameCanvas *canvas;
+    int64_t time_us;  // Requested time in queue; actual time when retired.
+  };
+
   inline bool running() {
     MutexLock l(&running_mutex_);
     return running_;
   }
 
+  // Called with frame_sync_ held between two refreshes: switch to the
+  // latest queued canvas that is due.
+  void PresentDueFrame() {
+    const int64_t now = GetPresentationClockMicros();
+    if (presentation_queue_.front().time_us > now)
+      return;
+    while (presentation_queue_.size() > 1
+           && presentation_queue_[1].time_us <= now) {
+      Presentation skipped = { presentation_queue_.front().canvas, -1 };
+      retired_.push_back(skipped);
+      presentation_queue_.pop_front();
+    }
+    Presentation previous = { current_frame_, current_presented_at_us_ };
+    retired_.push_back(previous);
+    current_frame_ = presentation_queue_.front().canvas;
+    current_presented_at_us_ = now;
+    *active_frame_ = current_frame_;
+    presentation_queue_.pop_front();
+    pthread_cond_broadcast(&presentation_changed_);
+  }
+
+  // Called with frame_sync_ held: the output scale for the next refresh.
+  void AdvanceOutputRamp() {
+    const int64_t elapsed_us = GetPresentationClockMicros() - ramp_start_us_;
+    if (elapsed_us >= ramp_us_) {
+      output_scale_ = ramp_to_;
+    } else {
+      output_scale_ = ramp_from_
+        + (ramp_to_ - ramp_from_) * elapsed_us / ramp_us_;
+    }
+  }
+
   GPIO *const io_;
   const bool show_refresh_;
   uint32_t start_bit_[4];
+  // RGBMatrix::active_; follows the presented canvas once it is shown.
+  FrameCanvas *volatile *const active_frame_;
 
   Mutex running_mutex_;
   bool running_;
@@ -188,6 +287,19 @@ private:
   FrameCanvas *current_frame_;
   FrameCanvas *next_frame_;
   unsigned requested_frame_multiple_;
+
+  // PresentAt() queue; also guarded by frame_sync_.
+  pthread_cond_t presentation_changed_;
+  std::deque<Presentation> presentation_queue_;
+  std::deque<Presentation> retired_;
+  int64_t current_presented_at_us_;
+
+  // SetOutputScale() ramp; also guarded by frame_sync_.
+  float output_scale_;
+  float ramp_from_;
+  float ramp_to_;
+  int64_t ramp_start_us_;
+  int64_t ramp_us_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -245,7 +357,8 @@ RGBMatrix::Options::Options() :
 }
 
 RGBMatrix::RGBMatrix(GPIO *io, const Options &options)
-  : params_(options), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL) {
+  : params_(options), output_brightness_(100), io_(NULL), updater_(NULL),
+    shared_pixel_mapper_(NULL) {
   assert(params_.Validate(NULL));
   const MultiplexMapper *multiplex_mapper = NULL;
   if (params_.multiplexing > 0) {
@@ -262,7 +375,8 @@ RGBMatrix::RGBMatrix(GPIO *io, const Options &options)
     multiplex_mapper->EditColsRows(&params_.cols, &params_.rows);
   }
 
-  Framebuffer::InitHardwareMapping(params_.hardware_mapping);
+  Framebuffer::InitHardwareMapping(params_.hardware_mapping, params_.rows,
+                                   params_.row_address_type);
   active_ = CreateFrameCanvas();
   Clear();
   SetGPIO(io, true);
@@ -277,12 +391,14 @@ RGBMatrix::RGBMatrix(GPIO *io, const Options &options)
 
 RGBMatrix::RGBMatrix(GPIO *io, int rows, int chained_displays,
                      int parallel_displays)
-  : params_(Options()), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL) {
+  : params_(Options()), output_brightness_(100), io_(NULL), updater_(NULL),
+    shared_pixel_mapper_(NULL) {
   params_.rows = rows;
   params_.chain_length = chained_displays;
   params_.parallel = parallel_displays;
   assert(params_.Validate(NULL));
-  Framebuffer::InitHardwareMapping(params_.hardware_mapping);
+  Framebuffer::InitHardwareMapping(params_.hardware_mapping, params_.rows,
+                                   params_.row_address_type);
   active_ = CreateFrameCanvas();
   Clear();
   SetGPIO(io, true);
@@ -336,7 +452,7 @@ void RGBMatrix::SetGPIO(GPIO *io, bool start_thread) {
     Framebuffer::InitGPIO(io_, params_.rows, params_.parallel,
                           !params_.disable_hardware_pulsing,
                           params_.pwm_lsb_nanoseconds, params_.pwm_dither_bits,
-                          params_.row_address_type);
+                          params_.row_address_type, params_.scan_mode);
   }
   if (start_thread) {
     StartRefresh();
@@ -345,8 +461,9 @@ void RGBMatrix::SetGPIO(GPIO *io, bool start_thread) {
 
 bool RGBMatrix::StartRefresh() {
   if (updater_ == NULL && io_ != NULL) {
-    updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
-                                params_.show_refresh_rate);
+    updater_ = new UpdateThread(io_, &active_, params_.pwm_dither_bits,
+                                params_.show_refresh_rate,
+                                output_brightness_ / 100.0f);
     // If we have multiple processors, the kernel
     // jumps around between these, creating some global flicker.
     // So let's tie it to the last CPU available.
@@ -364,7 +481,6 @@ FrameCanvas *RGBMatrix::CreateFrameCanvas() {
     new FrameCanvas(new Framebuffer(params_.rows,
                                     params_.cols * params_.chain_length,
                                     params_.parallel,
-                                    params_.scan_mode,
                                     params_.led_rgb_sequence,
                                     params_.inverse_colors,
                                     &shared_pixel_mapper_));
@@ -381,14 +497,72 @@ FrameCanvas *RGBMatrix::CreateFrameCanvas() {
   return result;
 }
 
+internal::Framebuffer *RGBMatrix::matrix_framebuffer() const {
+  // The first canvas is created by the constructor, before any scroll canvas.
+  return created_frames_[0]->framebuffer();
+}
+
+FrameCanvas *RGBMatrix::CreateScrollCanvas(int width) {
+  const int columns = params_.cols * params_.chain_length;
+  if (width < columns) width = columns;
+  Framebuffer *fb = new Framebuffer(params_.rows, width, columns,
+                                    params_.parallel,
+                                    params_.led_rgb_sequence,
+                                    params_.inverse_colors);
+  // Scrolling by columns of the chain is only scrolling by pixels if the
+  // visible part of the canvas is laid out exactly like the matrix.
+  PixelDesignatorMap *own = fb->mapper();
+  bool same_layout = (shared_pixel_mapper_->width() == columns
+                      && shared_pixel_mapper_->height() == own->height());
+  for (int y = 0; same_layout && y < own->height(); ++y) {
+    for (int x = 0; same_layout && x < columns; ++x) {
+      const PixelDesignator *a = shared_pixel_mapper_->get(x, y);
+      const PixelDesignator *b = own->get(x, y);
+      int ax, ay, bx, by;
+      same_layout = (matrix_framebuffer()->GetPhysicalPosition(*a, &ax, &ay)
+                     && fb->GetPhysicalPosition(*b, &bx, &by)
+                     && ax == bx && ay == by
+                     && a->r_bit == b->r_bit && a->g_bit == b->g_bit
+                     && a->b_bit == b->b_bit);
+    }
+  }
+  if (!same_layout) {
+    fprintf(stderr, "Can't scroll a canvas with multiplexing or pixel "
+            "mappers.\n");
+    delete fb;
+    return NULL;
+  }
+
+  FrameCanvas *result = new FrameCanvas(fb);
+  fb->SetPWMBits(params_.pwm_bits);
+  fb->set_luminance_correct(do_luminance_correct_);
+  fb->SetBrightness(params_.brightness);
+  created_frames_.push_back(result);
+  return result;
+}
+
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned frame_fraction) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
-  FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
+  // Without refresh thread, e.g. without GPIO, there is nothing to wait for.
+  FrameCanvas *const previous = updater_
+    ? updater_->SwapOnVSync(other, frame_fraction) : active_;
   if (other) active_ = other;
   return previous;
 }
 
+bool RGBMatrix::PresentAt(FrameCanvas *canvas, int64_t present_at_us) {
+  if (updater_ == NULL || canvas == NULL) return false;
+  updater_->PresentAt(canvas, present_at_us);
+  return true;
+}
+
+FrameCanvas *RGBMatrix::AwaitRetiredCanvas(int64_t *presented_at_us,
+                                           int timeout_ms) {
+  if (!updater_) return NULL;
+  return updater_->AwaitRetiredCanvas(presented_at_us, timeout_ms);
+}
+
 uint32_t RGBMatrix::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
@@ -423,13 +597,22 @@ uint8_t RGBMatrix::brightness() {
   return params_.brightness;
 }
 
+void RGBMatrix::SetOutputBrightness(uint8_t percent, int ramp_ms) {
+  output_brightness_ = (percent <= 100 ? (percent != 0 ? percent : 1) : 100);
+  if (updater_) updater_->SetOutputScale(output_brightness_ / 100.0f, ramp_ms);
+}
+
+uint8_t RGBMatrix::output_brightness() const {
+  return output_brightness_;
+}
+
 // -- Implementation of RGBMatrix Canvas: delegation to ContentBuffer
 int RGBMatrix::width() const {
-  return active_->width();
+  return shared_pixel_mapper_->width();
 }
 
 int RGBMatrix::height() const {
-  return active_->height();
+  return shared_pixel_mapper_->height();
 }
 
 void RGBMatrix::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) {
@@ -444,6 +627,50 @@ void RGBMatrix::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   active_->Fill(red, green, blue);
 }
 
+void RGBMatrix::FillRect(int x, int y, int width, int height,
+                         uint8_t red, uint8_t green, uint8_t blue) {
+  active_->FillRect(x, y, width, height, red, green, blue);
+}
+
+namespace {
+// Fills rows of the new PixelDesignatorMap with designators looked up in the
+// old map through the PixelMapper. Rows are independent, so this can run
+// in parallel.
+class PixelMapperRowFunction : public internal::RowRangeFunction {
+public:
+  PixelMapperRowFunction(const PixelMapper *mapper,
+                         internal::PixelDesignatorMap *old_map,
+                         internal::PixelDesignatorMap *new_map)
+    : mapper_(mapper), old_map_(old_map), new_map_(new_map) {}
+
+  virtual void ProcessRows(int y_start, int y_end) {
+    const int old_width = old_map_->width();
+    const int old_height = old_map_->height();
+    const int new_width = new_map_->width();
+    for (int y = y_start; y < y_end; ++y) {
+      internal::PixelDesignator *out = new_map_->get(0, y);
+      for (int x = 0; x < new_width; ++x, ++out) {
+        int orig_x = -1, orig_y = -1;
+        mapper_->MapVisibleToMatrix(old_width, old_height,
+                                    x, y, &orig_x, &orig_y);
+        if (orig_x < 0 || orig_y < 0 ||
+            orig_x >= old_width || orig_y >= old_height) {
+          fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
+                  "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
+          continue;
+        }
+        *out = *old_map_->get(orig_x, orig_y);
+      }
+    }
+  }
+
+private:
+  const PixelMapper *const mapper_;
+  internal::PixelDesignatorMap *const old_map_;
+  internal::PixelDesignatorMap *const new_map_;
+};
+}  // anonymous namespace
+
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   if (mapper == NULL) return true;
   using internal::PixelDesignatorMap;
@@ -455,28 +682,43 @@ bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   }
   PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
     new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
-  for (int y = 0; y < new_height; ++y) {
-    for (int x = 0; x < new_width; ++x) {
-	
-      int orig_x = -1, orig_y = -1;
-      mapper->MapVisibleToMatrix(old_width, old_height,
-                                 x, y, &orig_x, &orig_y);
-      if (orig_x < 0 || orig_y < 0 ||
-          orig_x >= old_width || orig_y >= old_height) {
-        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
-                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
+  PixelMapperRowFunction mapping(mapper, shared_pixel_mapper_, new_mapper);
+  internal::ProcessRowsInParallel(new_width, new_height, &mapping);
+  delete shared_pixel_mapper_;
+  shared_pixel_mapper_ = new_mapper;
+  return true;
+}
+
+void RGBMatrix::GetPixelMappingReport(PixelMappingReport *report) const {
+  const internal::Framebuffer *fb = matrix_framebuffer();
+  const int width = shared_pixel_mapper_->width();
+  const int height = shared_pixel_mapper_->height();
+  report->visible_width = width;
+  report->visible_height = height;
+  report->physical_width = fb->physical_width();
+  report->physical_height = fb->physical_height();
+  report->unmapped = report->collisions = report->holes = 0;
+  report->visible_to_physical.assign(width * height, -1);
+
+  std::vector<bool> reached(fb->physical_width() * fb->physical_height());
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int px, py;
+      if (!fb->GetPhysicalPosition(*shared_pixel_mapper_->get(x, y),
+                                   &px, &py)) {
+        ++report->unmapped;
         continue;
-		
       }
-      const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
-      *new_mapper->get(x, y) = *orig_designator;
-	  
+      const int physical = py * fb->physical_width() + px;
+      report->visible_to_physical[y * width + x] = physical;
+      if (reached[physical])
+        ++report->collisions;
+      reached[physical] = true;
     }
   }
-  delete shared_pixel_mapper_;
-  shared_pixel_mapper_ = new_mapper;
-  return true;
+  for (size_t i = 0; i < reached.size(); ++i) {
+    if (!reached[i]) ++report->holes;
+  }
 }
 
 #ifndef REMOVE_DEPRECATED_TRANSFORMERS
@@ -562,10 +804,31 @@ void FrameCanvas::SetPixel(int x, int y,
                          uint8_t red, uint8_t green, uint8_t blue) {
   frame_->SetPixel(x, y, red, green, blue);
 }
+void FrameCanvas::SetPixels(int x, int y, int width, int height,
+                            const uint8_t *rgb, int stride) {
+  frame_->SetPixels(x, y, width, height, rgb, stride);
+}
+void FrameCanvas::SetIndexedPixels(int x, int y, int width, int height,
+                                   const uint8_t *indexes, int stride,
+                                   const uint8_t *palette_rgb,
+                                   int palette_size, int transparent_index) {
+  frame_->SetIndexedPixels(x, y, width, height, indexes, stride,
+                           palette_rgb, palette_size, transparent_index);
+}
 void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
 }
+void FrameCanvas::FillRect(int x, int y, int width, int height,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->FillRect(x, y, width, height, red, green, blue);
+}
+void FrameCanvas::CopyRect(const FrameCanvas &src, int src_x, int src_y,
+                           int width, int height, int dst_x, int dst_y) {
+  frame_->CopyRect(src.frame_, src_x, src_y, width, height, dst_x, dst_y);
+}
+void FrameCanvas::SetScrollOffset(int x) { frame_->SetOutputOffset(x); }
+int FrameCanvas::scroll_offset() const { return frame_->output_offset(); }
 bool FrameCanvas::SetPWMBits(uint8_t value) { return frame_->SetPWMBits(value); }
 uint8_t FrameCanvas::pwmbits() { return frame_->pwmbits(); }
 
@@ -582,6 +845,17 @@ void FrameCanvas::Serialize(const char **data, size_t *len) const {
 bool FrameCanvas::Deserialize(const char *data, size_t len) {
   return frame_->Deserialize(data, len);
 }
+bool FrameCanvas::DeserializeNoCopy(const char *data, size_t len) {
+  return frame_->DeserializeNoCopy(data, len);
+}
+size_t FrameCanvas::SerializeActivePlanes(char *data, size_t len,
+                                          uint8_t *pwm_bits) const {
+  return frame_->SerializeActivePlanes(data, len, pwm_bits);
+}
+bool FrameCanvas::DeserializeActivePlanes(const char *data, size_t len,
+                                          uint8_t pwm_bits) {
+  return frame_->DeserializeActivePlanes(data, len, pwm_bits);
+}
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
@@ -368,6 +368,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
 
   fprintf(out,
           "\t--led-gpio-mapping=<name> : Name of GPIO mapping used. Default \"%s\"\n"
+          "\t                            Or a {...} pin description or file "
+          "with one for custom boards.\n"
           "\t--led-rows=<rows>         : Panel rows. Typically 8, 16, 32 or 64."
           " (Default: %d).\n"
           "\t--led-cols=<cols>         : Panel columns. Typically 32 or 64. "
@@ -453,6 +455,16 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     err->append("Multiplexing can only be one of 0=normal; ")
       .append(CreateAvailableMultiplexString(muxers));
     success = false;
+  } else if (multiplexing > 0) {
+    // The panel as the multiplexer drives it needs to be usable as well.
+    int physical_cols = cols, physical_rows = rows;
+    muxers[multiplexing - 1]->EditColsRows(&physical_cols, &physical_rows);
+    if (physical_rows < 4 || physical_rows > 64 || physical_rows % 2 != 0) {
+      err->append("Multiplexing ")
+        .append(muxers[multiplexing - 1]->GetName())
+        .append(" can't be used with this number of rows (--led-rows).\n");
+      success = false;
+    }
   }
 
   if (row_address_type < 0 || row_address_type > 2) {
@@ -0,0 +1,148 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "palette-canvas.h"
+
+#include <string.h>
+
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+
+PaletteCanvas::PaletteCanvas(int width, int height)
+  : width_(width), height_(height), indexes_(new uint8_t[width * height]),
+    palette_size_(1), last_valid_(false), last_index_(0) {
+  memset(indexes_, 0, width_ * height_);
+  memset(palette_, 0, sizeof(palette_));
+}
+
+PaletteCanvas::~PaletteCanvas() {
+  delete [] indexes_;
+}
+
+void PaletteCanvas::SetPaletteColor(uint8_t index, uint8_t red, uint8_t green,
+                                    uint8_t blue) {
+  uint8_t *const entry = palette_ + 3 * index;
+  entry[0] = red;
+  entry[1] = green;
+  entry[2] = blue;
+  if (index >= palette_size_) palette_size_ = index + 1;
+  last_valid_ = false;
+}
+
+uint8_t PaletteCanvas::FindColor(uint8_t red, uint8_t green,
+                                 uint8_t blue) const {
+  int best_index = 0;
+  int best_distance = 3 * 256 * 256;
+  for (int i = 0; i < palette_size_; ++i) {
+    const uint8_t *const entry = palette_ + 3 * i;
+    const int dr = entry[0] - red;
+    const int dg = entry[1] - green;
+    const int db = entry[2] - blue;
+    const int distance = dr * dr + dg * dg + db * db;
+    if (distance < best_distance) {
+      if (distance == 0) return i;
+      best_distance = distance;
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
+inline uint8_t PaletteCanvas::ColorIndex(uint8_t red, uint8_t green,
+                                         uint8_t blue) {
+  if (!last_valid_ || red != last_rgb_[0] || green != last_rgb_[1]
+      || blue != last_rgb_[2]) {
+    last_rgb_[0] = red;
+    last_rgb_[1] = green;
+    last_rgb_[2] = blue;
+    last_index_ = FindColor(red, green, blue);
+    last_valid_ = true;
+  }
+  return last_index_;
+}
+
+void PaletteCanvas::SetPixel(int x, int y,
+                             uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+  indexes_[y * width_ + x] = ColorIndex(red, green, blue);
+}
+
+void PaletteCanvas::Clear() {
+  FillIndex(0);
+}
+
+void PaletteCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  FillIndex(ColorIndex(red, green, blue));
+}
+
+void PaletteCanvas::FillRect(int x, int y, int width, int height,
+                             uint8_t red, uint8_t green, uint8_t blue) {
+  if (x < 0) { width += x; x = 0; }
+  if (y < 0) { height += y; y = 0; }
+  if (x + width > width_) width = width_ - x;
+  if (y + height > height_) height = height_ - y;
+  if (width <= 0 || height <= 0) return;
+  const uint8_t index = ColorIndex(red, green, blue);
+  for (int row = y; row < y + height; ++row) {
+    memset(indexes_ + row * width_ + x, index, width);
+  }
+}
+
+void PaletteCanvas::SetIndex(int x, int y, uint8_t index) {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return;
+  indexes_[y * width_ + x] = index;
+}
+
+uint8_t PaletteCanvas::GetIndex(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return 0;
+  return indexes_[y * width_ + x];
+}
+
+void PaletteCanvas::FillIndex(uint8_t index) {
+  memset(indexes_, index, width_ * height_);
+}
+
+void PaletteCanvas::SetIndexedPixels(int x, int y, int width, int height,
+                                     const uint8_t *indexes, int stride,
+                                     const uint8_t *palette_rgb,
+                                     int palette_size, int transparent_index) {
+  if (x < 0) { indexes -= x; width += x; x = 0; }
+  if (y < 0) { indexes -= stride * y; height += y; y = 0; }
+  if (x + width > width_) width = width_ - x;
+  if (y + height > height_) height = height_ - y;
+  if (width <= 0 || height <= 0 || palette_size <= 0) return;
+  if (palette_size > 256) palette_size = 256;
+
+  uint8_t own_index[256];
+  for (int i = 0; i < palette_size; ++i) {
+    const uint8_t *rgb = palette_rgb + 3 * i;
+    own_index[i] = FindColor(rgb[0], rgb[1], rgb[2]);
+  }
+  for (int row = 0; row < height; ++row, indexes += stride) {
+    uint8_t *const out = indexes_ + (y + row) * width_ + x;
+    for (int col = 0; col < width; ++col) {
+      const int index = indexes[col];
+      if (index == transparent_index || index >= palette_size) continue;
+      out[col] = own_index[index];
+    }
+  }
+}
+
+void PaletteCanvas::CopyTo(FrameCanvas *canvas, int x, int y) const {
+  canvas->SetIndexedPixels(x, y, width_, height_, indexes_, width_,
+                           palette_, palette_size_, -1);
+}
+
+}  // namespace rgb_matrix
@@ -167,6 +167,55 @@ private:
   int parallel_;
 };
 
+// Panels with 1:4 or 1:8 scan that are wired in a "snake": the shift
+// registers of one row address run through a tile of "tile_width" columns
+// in the upper half of the scan group, then continue in the lower half
+// before going to the next tile. The matrix then looks twice as wide and
+// half as high as the visible panel.
+//
+// This used to be done at draw-time with the Snake8x2Transformer and
+// Snake16x8Transformer canvases in the KIB code; as a PixelMapper it is
+// resolved once when building the pixel mapping.
+//
+// "Snake8x2" is for the 32x16 P10 panels (tile 8 wide, 4 rows per scan
+// group), "Snake16x8" for the 32x32 P5 panels (tile 16 wide, 8 rows).
+class SnakePixelMapper : public PixelMapper {
+public:
+  SnakePixelMapper(const char *name, int tile_width, int tile_height)
+    : name_(name), tile_width_(tile_width), tile_height_(tile_height) {}
+
+  virtual const char *GetName() const { return name_; }
+
+  virtual bool GetSizeMapping(int matrix_width, int matrix_height,
+                              int *visible_width, int *visible_height)
+    const {
+    if (matrix_width % (2 * tile_width_) != 0
+        || matrix_height % tile_height_ != 0) {
+      fprintf(stderr, "%s: matrix %dx%d needs a width divisible by %d and "
+              "a height divisible by %d\n", GetName(),
+              matrix_width, matrix_height, 2 * tile_width_, tile_height_);
+      return false;
+    }
+    *visible_width = matrix_width / 2;
+    *visible_height = matrix_height * 2;
+    return true;
+  }
+
+  virtual void MapVisibleToMatrix(int matrix_width, int matrix_height,
+                                  int x, int y,
+                                  int *matrix_x, int *matrix_y) const {
+    const bool is_upper_half = (y / tile_height_) % 2 == 0;
+    *matrix_x = ((x / tile_width_) * 2 * tile_width_ + x % tile_width_
+                 + (is_upper_half ? tile_width_ : 0));
+    *matrix_y = (y / (2 * tile_height_)) * tile_height_ + y % tile_height_;
+  }
+
+private:
+  const char *const name_;
+  const int tile_width_;
+  const int tile_height_;
+};
+
 /******************************/
 /******************************/
 /***** XYFlipped **/
@@ -274,6 +323,8 @@ static MapperByName *CreateMapperMap() {
   RegisterPixelMapperInternal(result, new RotatePixelMapper());
   RegisterPixelMapperInternal(result, new UArrangementMapper());
   RegisterPixelMapperInternal(result, new XYFlipped());
+  RegisterPixelMapperInternal(result, new SnakePixelMapper("Snake8x2", 8, 4));
+  RegisterPixelMapperInternal(result, new SnakePixelMapper("Snake16x8", 16, 8));
   return result;
 }
 
@@ -0,0 +1,325 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "shm-frame-ring.h"
+#include "led-matrix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace rgb_matrix {
+
+static const uint32_t kRingMagicValue = 0x5A4D4853;  // "SHMZ"
+static const size_t kSlotAlignment = 64;
+
+// At the start of the shared memory, followed by the slots. Each slot is a
+// ShmSlotHeader followed by the frame data.
+//
+// Slot i % slot_count is written by the producer while
+// published - consumed < slot_count, and read by the consumer while
+// consumed < published. Both counters only ever increase (and wrap); each
+// is only written by one side and doubles as futex the other side waits on.
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t slot_count;
+  uint32_t width;
+  uint32_t height;
+  uint64_t slot_data_size;  // Bytes available for frame data per slot.
+  uint64_t bitplane_size;
+  volatile uint32_t published;
+  volatile uint32_t consumed;
+  volatile uint32_t closed;   // Set when the consumer goes away.
+};
+
+struct ShmSlotHeader {
+  uint32_t format;          // ShmFrameFormat
+  uint32_t size;
+  int64_t present_at_us;
+};
+
+static size_t AlignUp(size_t value) {
+  return (value + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+
+static size_t SlotStride(size_t slot_data_size) {
+  return AlignUp(sizeof(ShmSlotHeader) + slot_data_size);
+}
+
+// The geometry comes from the caller's own copy: the other process can
+// write anything into the ring header.
+static ShmSlotHeader *Slot(ShmRingHeader *ring, uint32_t slot_count,
+                           size_t slot_stride, uint32_t count) {
+  char *const slots = (char*)ring + AlignUp(sizeof(ShmRingHeader));
+  return (ShmSlotHeader*)(slots + (count % slot_count) * slot_stride);
+}
+
+static void FutexWake(volatile uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+// The longest single futex wait while watching a "closed" flag. Setting the
+// flag and the wake-up can happen between our check and the wait.
+static const int64_t kClosedPollUs = 100 * 1000;
+
+// Wait until "*addr" is different from "value", or "*closed" (if not NULL)
+// is set. Between processes, so no FUTEX_PRIVATE_FLAG. Returns false on
+// timeout.
+static bool FutexWaitChange(volatile uint32_t *addr, uint32_t value,
+                            const volatile uint32_t *closed,
+                            int timeout_ms) {
+  const int64_t deadline_us = GetPresentationClockMicros()
+    + timeout_ms * 1000LL;
+  while (*addr == value && !(closed && *closed)) {
+    int64_t wait_us = -1;
+    if (timeout_ms >= 0) {
+      wait_us = deadline_us - GetPresentationClockMicros();
+      if (wait_us <= 0) return false;
+    }
+    if (closed && (wait_us < 0 || wait_us > kClosedPollUs))
+      wait_us = kClosedPollUs;
+    struct timespec wait;
+    struct timespec *wait_ptr = NULL;
+    if (wait_us >= 0) {
+      wait.tv_sec = wait_us / 1000000;
+      wait.tv_nsec = (wait_us % 1000000) * 1000;
+      wait_ptr = &wait;
+    }
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, wait_ptr, NULL, 0);
+  }
+  return true;
+}
+
+ShmFrameConsumer *ShmFrameConsumer::Create(const char *name,
+                                           int width, int height,
+                                           size_t bitplane_size, int slots,
+                                           mode_t mode) {
+  if (width <= 0 || height <= 0 || slots < 2) {
+    fprintf(stderr, "Shared memory ring needs a size and at least 2 slots\n");
+    return NULL;
+  }
+  size_t slot_data_size = (size_t)width * height * 3;
+  if (bitplane_size > slot_data_size) slot_data_size = bitplane_size;
+  const size_t mapped_size = AlignUp(sizeof(ShmRingHeader))
+    + slots * SlotStride(slot_data_size);
+
+  shm_unlink(name);  // Left over from an earlier run.
+  const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+  if (fd < 0) {
+    fprintf(stderr, "Can't create shared memory %s: %s\n",
+            name, strerror(errno));
+    return NULL;
+  }
+  fchmod(fd, mode);  // Not restricted by the umask.
+  void *mem = MAP_FAILED;
+  if (ftruncate(fd, mapped_size) == 0) {
+    mem = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Can't map shared memory %s: %s\n", name, strerror(errno));
+    shm_unlink(name);
+    return NULL;
+  }
+
+  ShmRingHeader *ring = (ShmRingHeader*) mem;
+  ring->slot_count = slots;
+  ring->width = width;
+  ring->height = height;
+  ring->slot_data_size = slot_data_size;
+  ring->bitplane_size = bitplane_size;
+  ring->published = 0;
+  ring->consumed = 0;
+  ring->closed = 0;
+  __sync_synchronize();
+  ring->magic = kRingMagicValue;  // Last: now producers can use it.
+  return new ShmFrameConsumer(name, ring, mapped_size, width, height, slots,
+                              slot_data_size);
+}
+
+ShmFrameConsumer::ShmFrameConsumer(const std::string &name,
+                                   ShmRingHeader *ring, size_t mapped_size,
+                                   int width, int height, uint32_t slot_count,
+                                   size_t slot_data_size)
+  : name_(name), ring_(ring), mapped_size_(mapped_size),
+    width_(width), height_(height), slot_count_(slot_count),
+    slot_data_size_(slot_data_size),
+    slot_stride_(SlotStride(slot_data_size)) {}
+
+ShmFrameConsumer::~ShmFrameConsumer() {
+  ring_->closed = 1;
+  FutexWake(&ring_->consumed);  // Don't leave a producer waiting.
+  munmap(ring_, mapped_size_);
+  shm_unlink(name_.c_str());
+}
+
+bool ShmFrameConsumer::GetNext(FrameCanvas *canvas, int64_t *present_at_us,
+                               int timeout_ms) {
+  const uint32_t consumed = ring_->consumed;
+  if (ring_->published == consumed
+      && !FutexWaitChange(&ring_->published, consumed, NULL, timeout_ms)) {
+    return false;
+  }
+  __sync_synchronize();  // See the slot content written before 'published'.
+
+  // The producer can change the slot header any time; read it once.
+  const volatile ShmSlotHeader *slot = Slot(ring_, slot_count_, slot_stride_,
+                                            consumed);
+  const uint32_t format = slot->format;
+  const size_t size = slot->size;
+  const int64_t slot_present_at_us = slot->present_at_us;
+  const uint8_t *data = (const uint8_t*)(slot + 1);
+  bool success = true;
+  if (size > slot_data_size_) {
+    success = false;
+  } else if (format == kShmFrameRGB24
+             && size == (size_t)width_ * height_ * 3) {
+    canvas->SetPixels(0, 0, width_, height_, data, width_ * 3);
+  } else if (format == kShmFrameBitplanes) {
+    success = canvas->Deserialize((const char*)data, size);
+  } else {
+    success = false;
+  }
+  if (present_at_us) *present_at_us = slot_present_at_us;
+
+  // The data is copied, so the producer can have the slot back.
+  __sync_synchronize();
+  ring_->consumed = consumed + 1;
+  FutexWake(&ring_->consumed);
+  return success;
+}
+
+ShmFrameProducer *ShmFrameProducer::Attach(const char *name) {
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open shared memory %s: %s. Is the matrix "
+            "process running?\n", name, strerror(errno));
+    return NULL;
+  }
+  // Only one producer at a time. The lock goes away with the process.
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    fprintf(stderr, "Another producer is attached to %s\n", name);
+    close(fd);
+    return NULL;
+  }
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmRingHeader)) {
+    mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Can't map shared memory %s\n", name);
+    close(fd);
+    return NULL;
+  }
+  ShmRingHeader *ring = (ShmRingHeader*) mem;
+  const uint32_t slot_count = ring->slot_count;
+  const uint64_t slot_data_size = ring->slot_data_size;
+  const int width = ring->width;
+  const int height = ring->height;
+  const uint64_t bitplane_size = ring->bitplane_size;
+  const uint64_t max_data_size = st.st_size;  // Also bounds the products.
+  if (ring->magic != kRingMagicValue || slot_count == 0
+      || width <= 0 || height <= 0
+      || slot_data_size > max_data_size
+      || (uint64_t)width * height * 3 > slot_data_size
+      || bitplane_size > slot_data_size
+      || AlignUp(sizeof(ShmRingHeader))
+      + (uint64_t)slot_count * SlotStride(slot_data_size)
+      > (uint64_t)st.st_size) {
+    fprintf(stderr, "%s is not a frame ring\n", name);
+    munmap(mem, st.st_size);
+    close(fd);
+    return NULL;
+  }
+  return new ShmFrameProducer(fd, ring, st.st_size, width, height,
+                              slot_count, slot_data_size, bitplane_size);
+}
+
+ShmFrameProducer::ShmFrameProducer(int fd, ShmRingHeader *ring,
+                                   size_t mapped_size, int width, int height,
+                                   uint32_t slot_count, size_t slot_data_size,
+                                   size_t bitplane_size)
+  : fd_(fd), ring_(ring), mapped_size_(mapped_size),
+    width_(width), height_(height), slot_count_(slot_count),
+    slot_stride_(SlotStride(slot_data_size)), bitplane_size_(bitplane_size) {}
+
+ShmFrameProducer::~ShmFrameProducer() {
+  munmap(ring_, mapped_size_);
+  close(fd_);
+}
+
+int ShmFrameProducer::width() const { return width_; }
+int ShmFrameProducer::height() const { return height_; }
+size_t ShmFrameProducer::bitplane_size() const { return bitplane_size_; }
+
+uint8_t *ShmFrameProducer::AwaitFreeSlot(int timeout_ms) {
+  const uint32_t published = ring_->published;
+  for (;;) {
+    if (ring_->closed) return NULL;
+    const uint32_t consumed = ring_->consumed;
+    if (published - consumed < slot_count_) break;
+    if (!FutexWaitChange(&ring_->consumed, consumed, &ring_->closed,
+                         timeout_ms))
+      return NULL;
+  }
+  __sync_synchronize();  // Consumer is done reading the slot.
+  return (uint8_t*)(Slot(ring_, slot_count_, slot_stride_, published) + 1);
+}
+
+void ShmFrameProducer::Publish(ShmFrameFormat format, size_t len,
+                               int64_t present_at_us) {
+  const uint32_t published = ring_->published;
+  ShmSlotHeader *slot = Slot(ring_, slot_count_, slot_stride_, published);
+  slot->format = format;
+  slot->size = len;
+  slot->present_at_us = present_at_us;
+  __sync_synchronize();  // Content visible before the slot is published.
+  ring_->published = published + 1;
+  FutexWake(&ring_->published);
+}
+
+uint8_t *ShmFrameProducer::BeginFrame(int timeout_ms) {
+  return AwaitFreeSlot(timeout_ms);
+}
+
+void ShmFrameProducer::EndFrame(int64_t present_at_us) {
+  Publish(kShmFrameRGB24, (size_t)width_ * height_ * 3, present_at_us);
+}
+
+bool ShmFrameProducer::Send(const FrameCanvas &canvas, int64_t present_at_us,
+                            int timeout_ms) {
+  const char *data;
+  size_t len;
+  canvas.Serialize(&data, &len);
+  if (len != bitplane_size_) {
+    fprintf(stderr, "Canvas does not match the matrix options of the "
+            "matrix process\n");
+    return false;
+  }
+  uint8_t *slot = AwaitFreeSlot(timeout_ms);
+  if (slot == NULL) return false;
+  memcpy(slot, data, len);
+  Publish(kShmFrameBitplanes, len, present_at_us);
+  return true;
+}
+}  // namespace rgb_matrix
@@ -0,0 +1,83 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "stream-player.h"
+
+#include "content-streamer.h"
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+
+// A frame is queued only this long before it is due. Once queued, it can't
+// be taken back, so this is also how long Stop() may have to wait for it.
+static const int64_t kPresentLeadUs = 10000;
+
+StreamPlayer::StreamPlayer(RGBMatrix *matrix, StreamIO *io,
+                           int64_t duration_us)
+  : matrix_(matrix), io_(io), duration_us_(duration_us),
+    canvas_(matrix->CreateFrameCanvas()), stop_(false) {
+  pthread_cond_init(&stop_changed_, NULL);
+}
+
+StreamPlayer::~StreamPlayer() {
+  Stop();
+  WaitStopped();
+  pthread_cond_destroy(&stop_changed_);
+}
+
+void StreamPlayer::Stop() {
+  MutexLock l(&mutex_);
+  stop_ = true;
+  pthread_cond_broadcast(&stop_changed_);
+}
+
+bool StreamPlayer::WaitUntil(int64_t time_us) {
+  MutexLock l(&mutex_);
+  for (;;) {
+    if (stop_) return false;
+    const int64_t wait_us = time_us - GetPresentationClockMicros();
+    if (wait_us <= 0) return true;
+    mutex_.WaitOn(&stop_changed_, (wait_us + 999) / 1000);
+  }
+}
+
+void StreamPlayer::Run() {
+  StreamReader reader(io_);
+  const int64_t start_us = GetPresentationClockMicros();
+  const int64_t end_us = duration_us_ < 0 ? -1 : start_us + duration_us_;
+  int64_t show_at_us = start_us;
+  while (end_us < 0 || show_at_us < end_us) {
+    uint32_t hold_time_us;
+    if (!reader.GetNext(canvas_, &hold_time_us)) {
+      if (end_us < 0) break;
+      reader.Rewind();
+      if (!reader.GetNext(canvas_, &hold_time_us)) break;
+    }
+    if (!WaitUntil(show_at_us - kPresentLeadUs)) break;
+    if (!matrix_->PresentAt(canvas_, show_at_us)) break;  // No refresh.
+    // Returns once this frame is on the screen.
+    canvas_ = matrix_->AwaitRetiredCanvas(NULL);
+    show_at_us += hold_time_us;
+  }
+
+  // The last frame stays for its hold time, unless stopped.
+  WaitUntil(end_us >= 0 && end_us < show_at_us ? end_us : show_at_us);
+  canvas_->Clear();
+  if (matrix_->PresentAt(canvas_, GetPresentationClockMicros())) {
+    canvas_ = matrix_->AwaitRetiredCanvas(NULL);
+    canvas_->Clear();  // Might still refer to frames in the StreamIO.
+  }
+}
+
+}  // namespace rgb_matrix
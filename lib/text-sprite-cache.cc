@@ -0,0 +1,196 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "text-sprite-cache.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+namespace {
+// Text is drawn onto this to find out which pixels it covers. Big enough
+// that nothing is clipped; the origin is in the middle.
+class RecordingCanvas : public Canvas {
+public:
+  static const int kOrigin = 1 << 14;
+
+  explicit RecordingCanvas(const Color &color) : color_(color) {}
+
+  virtual int width() const { return 2 * kOrigin; }
+  virtual int height() const { return 2 * kOrigin; }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    Pixel p;
+    p.x = x - kOrigin;
+    p.y = y - kOrigin;
+    p.foreground = (red == color_.r && green == color_.g && blue == color_.b);
+    pixels_.push_back(p);
+  }
+  virtual void Clear() { pixels_.clear(); }
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) {}
+
+  struct Pixel {
+    int x, y;
+    bool foreground;
+  };
+  const std::vector<Pixel> &pixels() const { return pixels_; }
+
+private:
+  const Color color_;
+  std::vector<Pixel> pixels_;
+};
+}  // namespace
+
+void TextSprite::Draw(FrameCanvas *c, int x, int y) const {
+  if (pixels_.empty()) return;
+  c->SetIndexedPixels(x + x_offset_, y + y_offset_, width_, height_,
+                      (const uint8_t*) pixels_.data(), width_,
+                      palette_, 3, 0);
+}
+
+struct TextSpriteCache::Entry {
+  std::string key;
+  TextSprite *sprite;
+};
+
+TextSpriteCache::TextSpriteCache(size_t budget_bytes)
+  : budget_bytes_(budget_bytes), bytes_used_(0), hits_(0), misses_(0) {
+}
+
+TextSpriteCache::~TextSpriteCache() {
+  Clear();
+}
+
+void TextSpriteCache::Clear() {
+  for (LruList::iterator it = lru_.begin(); it != lru_.end(); ++it) {
+    delete (*it)->sprite;
+    delete *it;
+  }
+  lru_.clear();
+  entries_.clear();
+  bytes_used_ = 0;
+}
+
+const TextSprite *TextSpriteCache::Get(const Font &font, const Color &color,
+                                       const Color *background_color,
+                                       const char *utf8_text,
+                                       int kerning_offset) {
+  // Everything that changes the pixels, followed by the text.
+  struct {
+    const Font *font;
+    int kerning_offset;
+    uint8_t colors[7];
+  } params;
+  memset(&params, 0, sizeof(params));
+  params.font = &font;
+  params.kerning_offset = kerning_offset;
+  params.colors[0] = color.r;
+  params.colors[1] = color.g;
+  params.colors[2] = color.b;
+  if (background_color) {
+    params.colors[3] = background_color->r;
+    params.colors[4] = background_color->g;
+    params.colors[5] = background_color->b;
+    params.colors[6] = 1;
+  }
+  std::string key((const char*) &params, sizeof(params));
+  key.append(utf8_text);
+
+  EntryMap::iterator found = entries_.find(key);
+  if (found != entries_.end()) {
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, found->second);  // Now most recent.
+    return lru_.front()->sprite;
+  }
+  ++misses_;
+
+  // With a background, the glyph pixels that are not foreground are
+  // background. The recording canvas tells them apart by color, so a
+  // background of the same color as the text is just foreground.
+  RecordingCanvas recorder(color);
+  TextSprite *sprite = new TextSprite();
+  sprite->advance_ = rgb_matrix::DrawText(&recorder, font,
+                                          RecordingCanvas::kOrigin,
+                                          RecordingCanvas::kOrigin,
+                                          color, background_color,
+                                          utf8_text, kerning_offset);
+  const std::vector<RecordingCanvas::Pixel> &pixels = recorder.pixels();
+  if (!pixels.empty()) {
+    int x_min = pixels[0].x, x_max = pixels[0].x;
+    int y_min = pixels[0].y, y_max = pixels[0].y;
+    for (size_t i = 1; i < pixels.size(); ++i) {
+      x_min = std::min(x_min, pixels[i].x);
+      x_max = std::max(x_max, pixels[i].x);
+      y_min = std::min(y_min, pixels[i].y);
+      y_max = std::max(y_max, pixels[i].y);
+    }
+    sprite->x_offset_ = x_min;
+    sprite->y_offset_ = y_min;
+    sprite->width_ = x_max - x_min + 1;
+    sprite->height_ = y_max - y_min + 1;
+    sprite->pixels_.assign(sprite->width_ * sprite->height_, '\0');
+    // Later pixels overwrite earlier ones, same as on a canvas.
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      const RecordingCanvas::Pixel &p = pixels[i];
+      sprite->pixels_[(p.y - y_min) * sprite->width_ + (p.x - x_min)]
+        = p.foreground ? 1 : 2;
+    }
+  }
+  memset(sprite->palette_, 0, sizeof(sprite->palette_));
+  sprite->palette_[3] = color.r;
+  sprite->palette_[4] = color.g;
+  sprite->palette_[5] = color.b;
+  if (background_color) {
+    sprite->palette_[6] = background_color->r;
+    sprite->palette_[7] = background_color->g;
+    sprite->palette_[8] = background_color->b;
+  }
+
+  Entry *entry = new Entry();
+  entry->key = key;
+  entry->sprite = sprite;
+  lru_.push_front(entry);
+  entries_[key] = lru_.begin();
+  bytes_used_ += sprite->bytes() + key.size();
+  EvictToBudget();
+  return sprite;
+}
+
+void TextSpriteCache::EvictToBudget() {
+  // The most recent one stays, even if it alone is over the budget.
+  while (bytes_used_ > budget_bytes_ && lru_.size() > 1) {
+    Entry *oldest = lru_.back();
+    lru_.pop_back();
+    entries_.erase(oldest->key);
+    bytes_used_ -= oldest->sprite->bytes() + oldest->key.size();
+    delete oldest->sprite;
+    delete oldest;
+  }
+}
+
+int TextSpriteCache::DrawText(FrameCanvas *c, const Font &font, int x, int y,
+                              const Color &color,
+                              const Color *background_color,
+                              const char *utf8_text, int kerning_offset) {
+  const TextSprite *sprite = Get(font, color, background_color, utf8_text,
+                                 kerning_offset);
+  sprite->Draw(c, x, y);
+  return sprite->advance();
+}
+
+}  // namespace rgb_matrix
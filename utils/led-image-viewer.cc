@@ -22,6 +22,7 @@
 #include "led-matrix.h"
 #include "pixel-mapper.h"
 #include "content-streamer.h"
+#include "thread.h"
 
 #include <fcntl.h>
 #include <math.h>
@@ -35,6 +36,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
+#include <list>
 #include <map>
 #include <string>
 #include <vector>
@@ -45,6 +48,8 @@
 using rgb_matrix::GPIO;
 using rgb_matrix::Canvas;
 using rgb_matrix::FrameCanvas;
+using rgb_matrix::Mutex;
+using rgb_matrix::MutexLock;
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::StreamReader;
 
@@ -61,9 +66,12 @@ struct ImageParams {
 };
 
 struct FileInfo {
+  FileInfo() : is_multi_frame(false), content_stream(NULL), memory_bytes(0) {}
+  ~FileInfo() { delete content_stream; }
   ImageParams params;      // Each file might have specific timing settings
   bool is_multi_frame;
   rgb_matrix::StreamIO *content_stream;
+  size_t memory_bytes;     // Memory used by content_stream.
 };
 
 volatile bool interrupt_received = false;
@@ -85,6 +93,16 @@ static void SleepMillis(tmillis_t milli_seconds) {
   nanosleep(&ts, NULL);
 }
 
+// Like SleepMillis(), but in short steps: a signal might be handled by
+// another thread and then would not end a long sleep.
+static void SleepMillisUnlessInterrupted(tmillis_t milli_seconds) {
+  const tmillis_t end_ms = GetTimeInMillis() + milli_seconds;
+  for (tmillis_t left = milli_seconds; left > 0 && !interrupt_received;
+       left = end_ms - GetTimeInMillis()) {
+    SleepMillis(std::min(left, (tmillis_t)100));
+  }
+}
+
 static void StoreInStream(const Magick::Image &img, int delay_time_us,
                           bool do_center,
                           rgb_matrix::FrameCanvas *scratch,
@@ -173,9 +191,228 @@ static bool LoadImageAndScale(const char *filename,
   return true;
 }
 
-void DisplayAnimation(const FileInfo *file,
-                      RGBMatrix *matrix, FrameCanvas *offscreen_canvas,
-                      int vsync_multiple) {
+// Load image, animation or stream file and prepare it for display.
+// Returns NULL and sets "err_msg" if that is not possible.
+static FileInfo *LoadFile(const char *filename, const ImageParams &params,
+                          bool do_center, FrameCanvas *scratch,
+                          std::string *err_msg) {
+  // These parameters are needed once we do scrolling.
+  const bool fill_width = false;
+  const bool fill_height = false;
+
+  std::vector<Magick::Image> image_sequence;
+  if (LoadImageAndScale(filename, scratch->width(), scratch->height(),
+                        fill_width, fill_height, &image_sequence, err_msg)) {
+    FileInfo *file_info = new FileInfo();
+    file_info->params = params;
+    file_info->content_stream = new rgb_matrix::MemStreamIO();
+    file_info->is_multi_frame = image_sequence.size() > 1;
+    rgb_matrix::StreamWriter out(file_info->content_stream);
+    for (size_t i = 0; i < image_sequence.size(); ++i) {
+      const Magick::Image &img = image_sequence[i];
+      int64_t delay_time_us;
+      if (file_info->is_multi_frame) {
+        delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
+      } else {
+        delay_time_us = file_info->params.wait_ms * 1000;  // single image.
+      }
+      if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
+      StoreInStream(img, delay_time_us, do_center, scratch, &out);
+    }
+    file_info->memory_bytes = file_info->content_stream->Size();
+    return file_info;
+  }
+
+  // Ok, not an image. Let's see if it is one of our streams.
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return NULL;
+  FileInfo *file_info = new FileInfo();
+  file_info->params = params;
+  // Mapped, so that frames are shown without copying them. It is in the
+  // page cache, so does not count as memory_bytes.
+  file_info->content_stream = new rgb_matrix::MmapStreamIO(fd);
+  StreamReader reader(file_info->content_stream);
+  if (!reader.GetNext(scratch, NULL)) {  // header+size ok ?
+    *err_msg = "Can't read as image or compatible stream";
+    delete file_info;
+    return NULL;
+  }
+  file_info->is_multi_frame = reader.GetNext(scratch, NULL);
+  reader.Rewind();
+  return file_info;
+}
+
+// Loads files on background threads while others are shown, so that
+// switching to the next file does not have to wait for decoding and scaling.
+// Loaded files are kept for the next time they are shown (e.g. with -f) as
+// long as they fit in the memory budget; after that, the ones shown longest
+// ago are dropped first. Files that are about to be shown are always loaded.
+class FileLoader {
+public:
+  FileLoader(RGBMatrix *matrix, bool do_center,
+             const std::vector<const char*> &filenames,
+             const std::vector<ImageParams> &params,
+             size_t memory_budget, int threads)
+    : do_center_(do_center), filenames_(filenames), params_(params),
+      slots_(filenames.size()), memory_budget_(memory_budget),
+      memory_used_(0), shutdown_(false) {
+    pthread_cond_init(&changed_, NULL);
+    for (int i = 0; i < threads; ++i) {
+      // Each worker needs its own canvas to render the frames on.
+      Worker *worker = new Worker(this, matrix->CreateFrameCanvas());
+      worker->Start();
+      workers_.push_back(worker);
+    }
+  }
+
+  ~FileLoader() {
+    {
+      MutexLock l(&mutex_);
+      shutdown_ = true;
+      pthread_cond_broadcast(&changed_);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i]->WaitStopped();
+      delete workers_[i];
+    }
+    for (size_t i = 0; i < slots_.size(); ++i) delete slots_[i].info;
+    pthread_cond_destroy(&changed_);
+  }
+
+  // Start loading file "index" in the background, if not already there.
+  void Prefetch(int index) {
+    MutexLock l(&mutex_);
+    PrefetchLocked(index);
+  }
+
+  // Wait until file "index" is loaded and return it; it stays in memory
+  // until Release()d. Returns NULL if it can't be loaded or if interrupted.
+  FileInfo *Get(int index) {
+    MutexLock l(&mutex_);
+    PrefetchLocked(index);
+    Slot &slot = slots_[index];
+    if (slot.state == QUEUED && !slot.urgent) {
+      // Needed now: ahead of all prefetching and regardless of budget.
+      slot.urgent = true;
+      queue_.erase(std::find(queue_.begin(), queue_.end(), index));
+      queue_.push_front(index);
+      pthread_cond_broadcast(&changed_);
+    }
+    while ((slot.state == QUEUED || slot.state == LOADING)
+           && !interrupt_received) {
+      mutex_.WaitOn(&changed_, 100);
+    }
+    return slot.state == LOADED ? slot.info : NULL;
+  }
+
+  // Done showing file "index". It may now be dropped to make room.
+  void Release(int index) {
+    MutexLock l(&mutex_);
+    if (slots_[index].state != LOADED) return;
+    released_.push_back(index);
+    pthread_cond_broadcast(&changed_);
+  }
+
+private:
+  enum State { NOT_LOADED, QUEUED, LOADING, LOADED, FAILED };
+  struct Slot {
+    Slot() : state(NOT_LOADED), urgent(false), info(NULL) {}
+    State state;
+    bool urgent;
+    FileInfo *info;
+  };
+
+  class Worker : public rgb_matrix::Thread {
+  public:
+    Worker(FileLoader *loader, FrameCanvas *scratch)
+      : loader_(loader), scratch_(scratch) {}
+    virtual void Run() { loader_->WorkerLoop(scratch_); }
+  private:
+    FileLoader *const loader_;
+    FrameCanvas *const scratch_;
+  };
+
+  void PrefetchLocked(int index) {
+    Slot &slot = slots_[index];
+    if (slot.state == NOT_LOADED) {
+      slot.state = QUEUED;
+      queue_.push_back(index);
+      pthread_cond_broadcast(&changed_);
+    } else if (slot.state == LOADED) {
+      released_.remove(index);  // Will be shown again; keep.
+    }
+  }
+
+  // Drop files shown longest ago until the next one fits in the budget.
+  // Returns true if there is room.
+  bool MakeRoomLocked() {
+    while (memory_used_ >= memory_budget_ && !released_.empty()) {
+      Slot &slot = slots_[released_.front()];
+      released_.pop_front();
+      memory_used_ -= slot.info->memory_bytes;
+      delete slot.info;
+      slot.info = NULL;
+      slot.state = NOT_LOADED;
+    }
+    return memory_used_ < memory_budget_;
+  }
+
+  void WorkerLoop(FrameCanvas *scratch) {
+    MutexLock l(&mutex_);
+    for (;;) {
+      while (!shutdown_
+             && (queue_.empty()
+                 || !(slots_[queue_.front()].urgent || MakeRoomLocked()))) {
+        mutex_.WaitOn(&changed_);
+      }
+      if (shutdown_) return;
+      const int index = queue_.front();
+      queue_.pop_front();
+      slots_[index].state = LOADING;
+
+      mutex_.Unlock();
+      std::string err_msg;
+      FileInfo *info = LoadFile(filenames_[index], params_[index], do_center_,
+                                scratch, &err_msg);
+      if (info == NULL) {
+        fprintf(stderr, "%s skipped: Unable to open (%s)\n",
+                filenames_[index], err_msg.c_str());
+      }
+      mutex_.Lock();
+
+      Slot &slot = slots_[index];
+      slot.info = info;
+      slot.state = info ? LOADED : FAILED;
+      slot.urgent = false;
+      if (info) memory_used_ += info->memory_bytes;
+      pthread_cond_broadcast(&changed_);
+    }
+  }
+
+  const bool do_center_;
+  const std::vector<const char*> filenames_;
+  const std::vector<ImageParams> params_;
+
+  Mutex mutex_;
+  pthread_cond_t changed_;
+  std::vector<Slot> slots_;
+  std::deque<int> queue_;     // Files to load, in order.
+  std::list<int> released_;   // Loaded files not in use, oldest first.
+  const size_t memory_budget_;
+  size_t memory_used_;
+  bool shutdown_;
+  std::vector<Worker*> workers_;
+};
+
+// How far ahead of its time a frame is queued with PresentAt(); keeps the
+// wait for its predecessor to retire short, so that a signal is noticed.
+static const int64_t kMaxQueueAheadUs = 100 * 1000;
+
+// Returns the canvas that is not on the screen now, to be used next time;
+// NULL if interrupted while waiting for it.
+FrameCanvas *DisplayAnimation(const FileInfo *file,
+                              RGBMatrix *matrix, FrameCanvas *offscreen_canvas,
+                              int vsync_multiple) {
   const tmillis_t duration_ms = (file->is_multi_frame
                                  ? file->params.anim_duration_ms
                                  : file->params.wait_ms);
@@ -183,23 +420,64 @@ void DisplayAnimation(const FileInfo *file,
   int loops = file->params.loops;
   const tmillis_t end_time_ms = GetTimeInMillis() + duration_ms;
   const tmillis_t override_anim_delay = file->params.anim_delay_ms;
+  // Without a vsync multiple, frames are queued with the absolute time they
+  // are due, so the time spent decoding them doesn't add up.
+  int64_t show_at_us = rgb_matrix::GetPresentationClockMicros();
+  bool single_frame = false;
   for (int k = 0;
        (loops < 0 || k < loops)
          && !interrupt_received
-         && GetTimeInMillis() < end_time_ms;
+         && GetTimeInMillis() < end_time_ms
+         && !single_frame;
        ++k) {
     uint32_t delay_us = 0;
+    int frames = 0;
     while (!interrupt_received && GetTimeInMillis() <= end_time_ms
            && reader.GetNext(offscreen_canvas, &delay_us)) {
-      const tmillis_t anim_delay_ms =
-        override_anim_delay >= 0 ? override_anim_delay : delay_us / 1000;
-      const tmillis_t start_wait_ms = GetTimeInMillis();
-      offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas, vsync_multiple);
-      const tmillis_t time_already_spent = GetTimeInMillis() - start_wait_ms;
-      SleepMillis(anim_delay_ms - time_already_spent);
+      ++frames;
+      const int64_t anim_delay_us =
+        override_anim_delay >= 0 ? override_anim_delay * 1000 : delay_us;
+      if (vsync_multiple > 1) {
+        const tmillis_t start_wait_ms = GetTimeInMillis();
+        offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas,
+                                               vsync_multiple);
+        const tmillis_t time_already_spent = GetTimeInMillis() - start_wait_ms;
+        SleepMillisUnlessInterrupted(anim_delay_us / 1000
+                                     - time_already_spent);
+      } else {
+        const int64_t ahead_us =
+          show_at_us - rgb_matrix::GetPresentationClockMicros();
+        if (ahead_us > kMaxQueueAheadUs)
+          SleepMillisUnlessInterrupted((ahead_us - kMaxQueueAheadUs) / 1000);
+        if (interrupt_received) break;
+        if (!matrix->PresentAt(offscreen_canvas, show_at_us)) {
+          // No refresh thread; nothing to wait for.
+          offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas);
+        } else {
+          offscreen_canvas = NULL;
+          while (offscreen_canvas == NULL && !interrupt_received) {
+            offscreen_canvas = matrix->AwaitRetiredCanvas(NULL, 100);
+          }
+        }
+        show_at_us += anim_delay_us;
+      }
     }
+    // A still image stays on the screen; showing it again would only wait
+    // for itself.
+    single_frame = (frames == 1);
     reader.Rewind();
   }
+  if (!interrupt_received) {
+    // Hold the last frame for its time, a still image for all of it.
+    tmillis_t hold_ms = end_time_ms - GetTimeInMillis();
+    if (!single_frame) {
+      hold_ms = (vsync_multiple > 1) ? 0 : std::min<tmillis_t>(
+        hold_ms,
+        (show_at_us - rgb_matrix::GetPresentationClockMicros()) / 1000);
+    }
+    SleepMillisUnlessInterrupted(hold_ms);
+  }
+  return offscreen_canvas;
 }
 
 static int usage(const char *progname) {
@@ -208,6 +486,8 @@ static int usage(const char *progname) {
 
   fprintf(stderr, "Options:\n"
           "\t-O<streamfile>            : Output to stream-file instead of matrix (Don't need to be root).\n"
+          "\t-K<keyframe-interval>     : With -O: store frames as changes to the previous frame,\n"
+          "\t                            with a full frame every this many frames.\n"
           "\t-C                        : Center images.\n"
 
           "\nThese options affect images following them on the command line:\n"
@@ -226,6 +506,7 @@ static int usage(const char *progname) {
           "Forever cycle through the list of files on the command line.\n"
           "\t-s                        : If multiple images are given: shuffle.\n"
           "\nDisplay Options:\n"
+          "\t-M<megabytes>             : Memory for files loaded ahead and kept for the next cycle (default: 256).\n"
           "\t-V<vsync-multiple>        : Expert: Only do frame vsync-swaps on multiples of refresh (default: 1)\n"
           );
 
@@ -276,9 +557,11 @@ int main(int argc, char *argv[]) {
   }
 
   const char *stream_output = NULL;
+  int keyframe_interval = 0;
+  size_t memory_budget_mb = 256;
 
   int opt;
-  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sO:V:D:")) != -1) {
+  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sO:K:M:V:D:")) != -1) {
     switch (opt) {
     case 'w':
       img_param.wait_ms = roundf(atof(optarg) * 1000.0f);
@@ -326,6 +609,12 @@ int main(int argc, char *argv[]) {
     case 'O':
       stream_output = strdup(optarg);
       break;
+    case 'K':
+      keyframe_interval = atoi(optarg);
+      break;
+    case 'M':
+      memory_budget_mb = std::max(1, atoi(optarg));
+      break;
     case 'V':
       vsync_multiple = atoi(optarg);
       if (vsync_multiple < 1) vsync_multiple = 1;
@@ -359,10 +648,6 @@ int main(int argc, char *argv[]) {
   printf("Size: %dx%d. Hardware gpio mapping: %s\n",
          matrix->width(), matrix->height(), matrix_options.hardware_mapping);
 
-  // These parameters are needed once we do scrolling.
-  const bool fill_width = false;
-  const bool fill_height = false;
-
   // In case the output to stream is requested, set up the stream object.
   rgb_matrix::StreamIO *stream_io = NULL;
   rgb_matrix::StreamWriter *global_stream_writer = NULL;
@@ -373,74 +658,55 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     stream_io = new rgb_matrix::FileStreamIO(fd);
-    global_stream_writer = new rgb_matrix::StreamWriter(stream_io);
+    global_stream_writer = new rgb_matrix::StreamWriter(stream_io,
+                                                        keyframe_interval);
   }
 
-  const tmillis_t start_load = GetTimeInMillis();
-  fprintf(stderr, "Loading %d files...\n", argc - optind);
-  // Preparing all the images beforehand as the Pi might be too slow to
-  // be quickly switching between these. So preprocess.
-  std::vector<FileInfo*> file_imgs;
+  // Images are decoded and scaled on background threads, so that the first
+  // one shows quickly and the next ones are ready when needed. One core is
+  // left for the matrix refresh.
+  std::vector<const char*> filenames;
+  std::vector<ImageParams> params;
   for (int imgarg = optind; imgarg < argc; ++imgarg) {
-    const char *filename = argv[imgarg];
-    FileInfo *file_info = NULL;
-
-    std::string err_msg;
-    std::vector<Magick::Image> image_sequence;
-    if (LoadImageAndScale(filename, matrix->width(), matrix->height(),
-                          fill_width, fill_height, &image_sequence, &err_msg)) {
-      file_info = new FileInfo();
-      file_info->params = filename_params[filename];
-      file_info->content_stream = new rgb_matrix::MemStreamIO();
-      file_info->is_multi_frame = image_sequence.size() > 1;
-      rgb_matrix::StreamWriter out(file_info->content_stream);
-      for (size_t i = 0; i < image_sequence.size(); ++i) {
-        const Magick::Image &img = image_sequence[i];
-        int64_t delay_time_us;
-        if (file_info->is_multi_frame) {
-          delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
-        } else {
-          delay_time_us = file_info->params.wait_ms * 1000;  // single image.
-        }
-        if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
-        StoreInStream(img, delay_time_us, do_center, offscreen_canvas,
-                      global_stream_writer ? global_stream_writer : &out);
-      }
-    } else {
-      // Ok, not an image. Let's see if it is one of our streams.
-      int fd = open(filename, O_RDONLY);
-      if (fd >= 0) {
-        file_info = new FileInfo();
-        file_info->params = filename_params[filename];
-        file_info->content_stream = new rgb_matrix::FileStreamIO(fd);
-        StreamReader reader(file_info->content_stream);
-        if (reader.GetNext(offscreen_canvas, NULL)) {  // header+size ok
-          file_info->is_multi_frame = reader.GetNext(offscreen_canvas, NULL);
-          reader.Rewind();
-          if (global_stream_writer) {
-            CopyStream(&reader, global_stream_writer, offscreen_canvas);
-          }
-        } else {
-          err_msg = "Can't read as image or compatible stream";
-          delete file_info->content_stream;
-          delete file_info;
-          file_info = NULL;
-        }
+    filenames.push_back(argv[imgarg]);
+    params.push_back(filename_params[argv[imgarg]]);
+  }
+  if (filenames.size() == 1) {
+    // Single image: show forever.
+    params[0].wait_ms = distant_future;
+  } else {
+    for (size_t i = 0; i < params.size(); ++i) {
+      // Forever animation ? Set to loop only once, otherwise that animation
+      // would just run forever, stopping all the images after it.
+      if (params[i].loops < 0 && params[i].anim_duration_ms == distant_future) {
+        params[i].loops = 1;
       }
     }
-
-    if (file_info) {
-      file_imgs.push_back(file_info);
-    } else {
-      fprintf(stderr, "%s skipped: Unable to open (%s)\n",
-              filename, err_msg.c_str());
-    }
   }
+  const int load_threads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN) - 1);
+  FileLoader *loader = new FileLoader(matrix, do_center, filenames, params,
+                                      memory_budget_mb << 20, load_threads);
+  // Files to have in the works; a bit more than threads, so that a file that
+  // can't be loaded does not leave the next one waiting.
+  const size_t look_ahead = 2 * load_threads;
 
   if (stream_output) {
+    int stored = 0;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      for (size_t k = 0; k <= look_ahead && i + k < filenames.size(); ++k) {
+        loader->Prefetch(i + k);
+      }
+      FileInfo *file_info = loader->Get(i);
+      if (file_info == NULL) continue;
+      StreamReader reader(file_info->content_stream);
+      CopyStream(&reader, global_stream_writer, offscreen_canvas);
+      loader->Release(i);
+      ++stored;
+    }
+    delete loader;
     delete global_stream_writer;
     delete stream_io;
-    if (file_imgs.size()) {
+    if (stored) {
       fprintf(stderr, "Done: Output to stream %s; "
               "this can now be opened with led-image-viewer with the exact same panel configuration settings such as rows, chain, parallel and hardware-mapping\n", stream_output);
     }
@@ -452,37 +718,46 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  // Some parameter sanity adjustments.
-  if (file_imgs.empty()) {
-    // e.g. if all files could not be interpreted as image.
-    fprintf(stderr, "No image could be loaded.\n");
-    return 1;
-  } else if (file_imgs.size() == 1) {
-    // Single image: show forever.
-    file_imgs[0]->params.wait_ms = distant_future;
-  } else {
-    for (size_t i = 0; i < file_imgs.size(); ++i) {
-      ImageParams &params = file_imgs[i]->params;
-      // Forever animation ? Set to loop only once, otherwise that animation
-      // would just run forever, stopping all the images after it.
-      if (params.loops < 0 && params.anim_duration_ms == distant_future) {
-        params.loops = 1;
-      }
-    }
-  }
-
-  fprintf(stderr, "Loading took %.3fs; now: Display.\n",
-          (GetTimeInMillis() - start_load) / 1000.0);
-
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT, InterruptHandler);
 
+  // The order of the next round is decided ahead, so that its first files
+  // can be loaded while the last ones of this round are shown.
+  std::vector<int> order(filenames.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  if (do_shuffle) std::random_shuffle(order.begin(), order.end());
+  std::vector<int> next_order = order;
+  // The file a frame on the screen comes from. Frames of stream files refer
+  // to the mapped file (see MmapStreamIO), so it is only released once a
+  // frame of the next file replaced it.
+  int on_screen = -1;
   do {
-    if (do_shuffle) {
-      std::random_shuffle(file_imgs.begin(), file_imgs.end());
+    order.swap(next_order);
+    if (do_shuffle) std::random_shuffle(next_order.begin(), next_order.end());
+    bool any_shown = false;
+    for (size_t i = 0; i < order.size() && !interrupt_received; ++i) {
+      // This one first, then the next ones.
+      for (size_t k = i; k <= i + look_ahead; ++k) {
+        if (k < order.size())
+          loader->Prefetch(order[k]);
+        else if (do_forever && k - order.size() < next_order.size())
+          loader->Prefetch(next_order[k - order.size()]);
+      }
+      FileInfo *file_info = loader->Get(order[i]);
+      if (file_info == NULL) continue;
+      offscreen_canvas = DisplayAnimation(file_info, matrix, offscreen_canvas,
+                                          vsync_multiple);
+      if (interrupt_received) break;  // Maybe nothing of it was shown.
+      if (on_screen >= 0 && on_screen != order[i]) loader->Release(on_screen);
+      on_screen = order[i];
+      any_shown = true;
     }
-    for (size_t i = 0; i < file_imgs.size() && !interrupt_received; ++i) {
-      DisplayAnimation(file_imgs[i], matrix, offscreen_canvas, vsync_multiple);
+    if (!any_shown && !interrupt_received) {
+      // e.g. if all files could not be interpreted as image.
+      fprintf(stderr, "No image could be loaded.\n");
+      delete loader;
+      delete matrix;
+      return 1;
     }
   } while (do_forever && !interrupt_received);
 
@@ -490,10 +765,13 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Caught signal. Exiting.\n");
   }
 
-  // Animation finished. Shut down the RGB matrix.
+  // Animation finished. The cleared screen no longer refers to a loaded
+  // file; then stop loading, that uses canvases of the matrix.
   matrix->Clear();
+  delete loader;
+
+  // Shut down the RGB matrix.
   delete matrix;
 
-  // Leaking the FileInfos, but don't care at program end.
   return 0;
 }
@@ -0,0 +1,144 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Owns the matrix and shows the frames other processes put into a shared
+// memory ring (see include/shm-frame-ring.h). The producers don't need root
+// or any access to the GPIO.
+//
+// $ sudo ./led-shm-server --led-rows=16 --led-cols=32 &
+// $ ../examples-api-use/shm-producer-example
+
+#include "led-matrix.h"
+#include "shm-frame-ring.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+using rgb_matrix::ShmFrameConsumer;
+
+// Frames are shown at most this long after they arrive.
+static const int64_t kMaxPresentAheadUs = 1000000;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Shows frames that other processes write to shared "
+          "memory.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-n <name>        : Name of the shared memory. "
+          "Default /led-matrix\n"
+          "\t-s <slots>       : Frames the producer can be ahead. "
+          "Default 3\n"
+          "\t-m <mode>        : Permissions of the shared memory in octal, "
+          "i.e. who\n"
+          "\t                   can be a producer. Default 0666\n"
+          "\t-v               : Print frames/second every 5 seconds.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  const char *shm_name = "/led-matrix";
+  int slots = 3;
+  mode_t mode = 0666;
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:m:v")) != -1) {
+    switch (opt) {
+    case 'n': shm_name = optarg; break;
+    case 's': slots = atoi(optarg); break;
+    case 'm': mode = strtol(optarg, NULL, 8); break;
+    case 'v': verbose = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  RGBMatrix *matrix = rgb_matrix::CreateMatrixFromOptions(matrix_options,
+                                                          runtime_opt);
+  if (matrix == NULL)
+    return 1;
+
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  const char *data;
+  size_t bitplane_size;
+  offscreen->Serialize(&data, &bitplane_size);
+
+  // Created after the matrix dropped privileges, so the shared memory does
+  // not belong to root.
+  ShmFrameConsumer *consumer =
+    ShmFrameConsumer::Create(shm_name, offscreen->width(), offscreen->height(),
+                             bitplane_size, slots, mode);
+  if (consumer == NULL) {
+    delete matrix;
+    return 1;
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  if (verbose) {
+    fprintf(stderr, "Waiting for %dx%d frames at %s\n",
+            offscreen->width(), offscreen->height(), shm_name);
+  }
+
+  long frames = 0;
+  int64_t report_start_us = rgb_matrix::GetPresentationClockMicros();
+  while (!interrupt_received) {
+    int64_t present_at_us;
+    // Short timeout, so that we notice interrupts.
+    if (consumer->GetNext(offscreen, &present_at_us, 100)) {
+      // The time comes from the producer. Bound it, so that a frame far in
+      // the future can't stall us; we wait for it to be shown.
+      const int64_t now_us = rgb_matrix::GetPresentationClockMicros();
+      if (present_at_us < now_us)
+        present_at_us = now_us;
+      if (present_at_us > now_us + kMaxPresentAheadUs)
+        present_at_us = now_us + kMaxPresentAheadUs;
+      matrix->PresentAt(offscreen, present_at_us);
+      offscreen = matrix->AwaitRetiredCanvas(NULL);
+      ++frames;
+    }
+    const int64_t now_us = rgb_matrix::GetPresentationClockMicros();
+    if (verbose && now_us - report_start_us >= 5000000) {
+      fprintf(stderr, "%.1f frames/s\n",
+              frames * 1e6 / (now_us - report_start_us));
+      frames = 0;
+      report_start_us = now_us;
+    }
+  }
+
+  delete consumer;
+  matrix->Clear();
+  delete matrix;
+  return 0;
+}
@@ -0,0 +1,225 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2015 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Compare the per-pixel cost of drawing through the pixel mappers given with
+// --led-pixel-mapper, which are resolved once into the pixel mapping, with
+// mapping each pixel at draw-time in a wrapping canvas, the way the old
+// CanvasTransformers did. Both must result in the same frame.
+// Does not need any hardware or root.
+//
+// $ make pixel-mapper-benchmark
+// $ ./pixel-mapper-benchmark --led-rows=8 --led-chain=8 --led-pixel-mapper=Snake8x2
+
+#include "led-matrix.h"
+#include "pixel-mapper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using rgb_matrix::Canvas;
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::PixelMapper;
+using rgb_matrix::RGBMatrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-n <passes>               : Full canvas passes per run "
+          "(default 200).\n"
+          "\t-r <runs>                 : Runs; the fastest counts "
+          "(default 5).\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  fprintf(stderr, "\nWithout --led-pixel-mapper, Snake8x2 is used.\n");
+  return 1;
+}
+
+// Maps each pixel when it is drawn, like a CanvasTransformer.
+class DrawTimeMapperCanvas : public Canvas {
+public:
+  DrawTimeMapperCanvas(Canvas *delegatee, const PixelMapper *mapper,
+                       int width, int height)
+    : delegatee_(delegatee), mapper_(mapper), width_(width), height_(height) {}
+
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void Clear() { delegatee_->Clear(); }
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) {
+    delegatee_->Fill(red, green, blue);
+  }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+    int matrix_x, matrix_y;
+    mapper_->MapVisibleToMatrix(delegatee_->width(), delegatee_->height(),
+                                x, y, &matrix_x, &matrix_y);
+    delegatee_->SetPixel(matrix_x, matrix_y, red, green, blue);
+  }
+
+private:
+  Canvas *const delegatee_;
+  const PixelMapper *const mapper_;
+  const int width_;
+  const int height_;
+};
+
+// Wrap "canvas" in a DrawTimeMapperCanvas for each mapper in the
+// --led-pixel-mapper "config", in the order RGBMatrix applies them.
+// Returns NULL if one of them can't be used.
+static Canvas *WrapInMappers(Canvas *canvas, const char *config,
+                             int chain, int parallel,
+                             std::vector<Canvas*> *wrappers) {
+  const std::string mappers = config;
+  size_t start = 0;
+  while (start < mappers.size()) {
+    size_t end = mappers.find(';', start);
+    if (end == std::string::npos) end = mappers.size();
+    std::string name = mappers.substr(start, end - start);
+    std::string parameter;
+    const size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+      parameter = name.substr(colon + 1);
+      name.erase(colon);
+    }
+    start = end + 1;
+    if (name.empty()) continue;
+    const PixelMapper *mapper = rgb_matrix::FindPixelMapper(
+      name.c_str(), chain, parallel,
+      colon != std::string::npos ? parameter.c_str() : NULL);
+    int width, height;
+    if (mapper == NULL
+        || !mapper->GetSizeMapping(canvas->width(), canvas->height(),
+                                   &width, &height)) {
+      return NULL;
+    }
+    canvas = new DrawTimeMapperCanvas(canvas, mapper, width, height);
+    wrappers->push_back(canvas);
+  }
+  return canvas;
+}
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Nanoseconds per SetPixel() of the fastest of "runs" runs of "passes"
+// passes over the whole canvas.
+static double MeasureSetPixel(Canvas *canvas, int passes, int runs) {
+  const int width = canvas->width();
+  const int height = canvas->height();
+  double best = -1;
+  for (int run = 0; run < runs; ++run) {
+    const double start = Now();
+    for (int pass = 0; pass < passes; ++pass) {
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          canvas->SetPixel(x, y, x + pass, y, x ^ y);
+        }
+      }
+    }
+    const double ns = (Now() - start) * 1e9 / passes / (width * height);
+    if (best < 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+static std::string Snapshot(FrameCanvas *canvas) {
+  const char *data;
+  size_t len;
+  canvas->Serialize(&data, &len);
+  return std::string(data, len);
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  int passes = 200;
+  int runs = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+    case 'n': passes = atoi(optarg); break;
+    case 'r': runs = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (passes <= 0 || runs <= 0)
+    return usage(argv[0]);
+  if (matrix_options.pixel_mapper_config == NULL
+      || *matrix_options.pixel_mapper_config == '\0') {
+    matrix_options.pixel_mapper_config = "Snake8x2";
+  }
+
+  std::string err;
+  if (!matrix_options.Validate(&err)) {
+    fprintf(stderr, "%s", err.c_str());
+    return 1;
+  }
+
+  // Same panels, once with the mappers baked into the pixel mapping...
+  RGBMatrix *mapped_matrix = new RGBMatrix(NULL, matrix_options);
+  FrameCanvas *mapped = mapped_matrix->CreateFrameCanvas();
+
+  // ... and once without, mapping each pixel when drawing it.
+  RGBMatrix::Options plain_options = matrix_options;
+  plain_options.pixel_mapper_config = NULL;
+  RGBMatrix *plain_matrix = new RGBMatrix(NULL, plain_options);
+  FrameCanvas *plain = plain_matrix->CreateFrameCanvas();
+  std::vector<Canvas*> wrappers;
+  Canvas *draw_time = WrapInMappers(plain, matrix_options.pixel_mapper_config,
+                                    matrix_options.chain_length,
+                                    matrix_options.parallel, &wrappers);
+  if (draw_time == NULL) {
+    fprintf(stderr, "Can't use --led-pixel-mapper=%s\n",
+            matrix_options.pixel_mapper_config);
+    return 1;
+  }
+  if (draw_time->width() != mapped->width()
+      || draw_time->height() != mapped->height()) {
+    fprintf(stderr, "RGBMatrix didn't apply all of --led-pixel-mapper=%s\n",
+            matrix_options.pixel_mapper_config);
+    return 1;
+  }
+
+  const double draw_time_ns = MeasureSetPixel(draw_time, passes, runs);
+  const double mapped_ns = MeasureSetPixel(mapped, passes, runs);
+  const bool same = (Snapshot(plain) == Snapshot(mapped));
+
+  printf("mapper=\"%s\" visible %dx%d, %d passes, best of %d runs\n",
+         matrix_options.pixel_mapper_config,
+         mapped->width(), mapped->height(), passes, runs);
+  printf("  draw-time mapping:  %6.2f ns/pixel\n", draw_time_ns);
+  printf("  pixel mapping:      %6.2f ns/pixel\n", mapped_ns);
+  printf("  frames %s\n", same ? "identical" : "DIFFER");
+
+  for (size_t i = 0; i < wrappers.size(); ++i) delete wrappers[i];
+  delete plain_matrix;
+  delete mapped_matrix;
+  return same ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2015 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Check that a panel configuration (multiplexing, pixel mappers, ...) maps
+// every visible pixel to exactly one LED and every LED is reachable.
+// Does not need any hardware or root, so it can run anywhere, e.g. in CI.
+//
+// $ make pixel-mapper-check
+// $ ./pixel-mapper-check --led-rows=8 --led-chain=8 --led-pixel-mapper=Snake8x2
+
+#include "led-matrix.h"
+#include "pixel-mapper.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using rgb_matrix::PixelMappingReport;
+using rgb_matrix::RGBMatrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-o <file.ppm>             : Write visible->physical mapping as "
+          "image.\n"
+          "\t                            Red/green: physical x/y of the LED; "
+          "blue: LED is shared\n"
+          "\t                            with another pixel; white: "
+          "unmapped.\n"
+          "\t-v                        : List the offending pixels.\n"
+          "\t-a                        : Check all multiplexing types "
+          "combined with each\n"
+          "\t                            registered pixel mapper for the "
+          "given rows/cols/chain/parallel.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  fprintf(stderr, "\nExit code is 0 if all checked mappings are a "
+          "bijection.\n");
+  return 1;
+}
+
+static bool WriteMappingImage(const PixelMappingReport &r,
+                              const char *filename) {
+  FILE *out = fopen(filename, "wb");
+  if (out == NULL) {
+    perror(filename);
+    return false;
+  }
+  std::vector<int> use_count(r.physical_width * r.physical_height);
+  for (size_t i = 0; i < r.visible_to_physical.size(); ++i) {
+    if (r.visible_to_physical[i] >= 0) ++use_count[r.visible_to_physical[i]];
+  }
+  const int max_x = r.physical_width > 1 ? r.physical_width - 1 : 1;
+  const int max_y = r.physical_height > 1 ? r.physical_height - 1 : 1;
+  fprintf(out, "P6\n%d %d\n255\n", r.visible_width, r.visible_height);
+  for (size_t i = 0; i < r.visible_to_physical.size(); ++i) {
+    const int physical = r.visible_to_physical[i];
+    uint8_t rgb[3] = { 255, 255, 255 };
+    if (physical >= 0) {
+      rgb[0] = 255 * (physical % r.physical_width) / max_x;
+      rgb[1] = 255 * (physical / r.physical_width) / max_y;
+      rgb[2] = use_count[physical] > 1 ? 255 : 0;
+    }
+    fwrite(rgb, 1, 3, out);
+  }
+  return fclose(out) == 0;
+}
+
+static void ListProblems(const PixelMappingReport &r) {
+  std::vector<int> first_user(r.physical_width * r.physical_height, -1);
+  for (size_t i = 0; i < r.visible_to_physical.size(); ++i) {
+    const int x = i % r.visible_width, y = i / r.visible_width;
+    const int physical = r.visible_to_physical[i];
+    if (physical < 0) {
+      printf("  unmapped:  visible (%d, %d)\n", x, y);
+    } else if (first_user[physical] >= 0) {
+      const int other = first_user[physical];
+      printf("  collision: visible (%d, %d) and (%d, %d) -> LED (%d, %d)\n",
+             x, y, other % r.visible_width, other / r.visible_width,
+             physical % r.physical_width, physical / r.physical_width);
+    } else {
+      first_user[physical] = i;
+    }
+  }
+  for (size_t i = 0; i < first_user.size(); ++i) {
+    if (first_user[i] < 0) {
+      printf("  hole:      LED (%d, %d)\n",
+             (int)i % r.physical_width, (int)i / r.physical_width);
+    }
+  }
+}
+
+// Whether RGBMatrix can apply all mappers in the --led-pixel-mapper config
+// of "options"; it leaves out those it can't, without failing. Mappers print
+// why they reject a parameter.
+static bool PixelMapperConfigValid(const RGBMatrix::Options &options) {
+  if (options.pixel_mapper_config == NULL) return true;
+  int width = options.cols * options.chain_length;
+  int height = options.rows * options.parallel;
+  const std::string config = options.pixel_mapper_config;
+  size_t start = 0;
+  while (start < config.size()) {
+    size_t end = config.find(';', start);
+    if (end == std::string::npos) end = config.size();
+    std::string name = config.substr(start, end - start);
+    std::string parameter;
+    const size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+      parameter = name.substr(colon + 1);
+      name.erase(colon);
+    }
+    start = end + 1;
+    if (name.empty()) continue;
+    const rgb_matrix::PixelMapper *mapper = rgb_matrix::FindPixelMapper(
+      name.c_str(), options.chain_length, options.parallel,
+      colon != std::string::npos ? parameter.c_str() : NULL);
+    if (mapper == NULL
+        || !mapper->GetSizeMapping(width, height, &width, &height)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The library reports problems on stderr; in a sweep over many
+// combinations these are expected, so they are kept out of the output.
+static int SilenceStderr() {
+  fflush(stderr);
+  const int saved = dup(STDERR_FILENO);
+  const int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+  }
+  return saved;
+}
+
+static void RestoreStderr(int saved) {
+  if (saved < 0) return;
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+}
+
+// Build the mapping for the options and print a one-line summary.
+// Returns true if it is a bijection.
+static bool CheckMapping(const RGBMatrix::Options &options,
+                         const char *image_file, bool verbose) {
+  std::string err;
+  if (!options.Validate(&err)) {
+    fprintf(stderr, "%s", err.c_str());
+    return false;
+  }
+  RGBMatrix *matrix = new RGBMatrix(NULL, options);
+  PixelMappingReport report;
+  matrix->GetPixelMappingReport(&report);
+  delete matrix;
+
+  printf("%-4s mux=%d mapper=\"%s\": visible %dx%d, physical %dx%d; "
+         "%d unmapped, %d collisions, %d holes\n",
+         report.IsBijection() ? "OK" : "FAIL",
+         options.multiplexing,
+         options.pixel_mapper_config ? options.pixel_mapper_config : "",
+         report.visible_width, report.visible_height,
+         report.physical_width, report.physical_height,
+         report.unmapped, report.collisions, report.holes);
+  if (verbose) ListProblems(report);
+  if (image_file && !WriteMappingImage(report, image_file)) {
+    return false;
+  }
+  return report.IsBijection();
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  const char *image_file = NULL;
+  bool verbose = false;
+  bool check_all = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:va")) != -1) {
+    switch (opt) {
+    case 'o':
+      image_file = strdup(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    case 'a':
+      check_all = true;
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  if (!check_all) {
+    if (!PixelMapperConfigValid(matrix_options)) {
+      fprintf(stderr, "Invalid --led-pixel-mapper=\"%s\"\n",
+              matrix_options.pixel_mapper_config);
+      return 1;
+    }
+    return CheckMapping(matrix_options, image_file, verbose) ? 0 : 1;
+  }
+
+  // Multiplexers are often written for one particular panel size, so a FAIL
+  // here is not necessarily a bug; it means that combination can't be used
+  // with these rows/cols.
+  std::vector<std::string> mappers = rgb_matrix::GetAvailablePixelMappers();
+  mappers.insert(mappers.begin(), "");
+  int failures = 0;
+  std::string invalid;  // Combinations rejected by the library.
+  int invalid_count = 0;
+  for (int mux = 0; ; ++mux) {
+    RGBMatrix::Options options;
+    options.multiplexing = mux;
+    std::string err;
+    if (!options.Validate(&err))
+      break;  // Ran out of multiplexing types.
+    options = matrix_options;
+    options.multiplexing = mux;
+    if (!options.Validate(&err)) {
+      char combination[32];
+      snprintf(combination, sizeof(combination), "%smux=%d",
+               invalid_count ? ", " : "", mux);
+      invalid.append(combination);
+      ++invalid_count;
+      continue;  // This multiplexer can't do these panels at all.
+    }
+    for (size_t i = 0; i < mappers.size(); ++i) {
+      options.pixel_mapper_config = mappers[i].c_str();
+      const int saved_stderr = SilenceStderr();
+      const bool valid = PixelMapperConfigValid(options);
+      bool success = true;
+      if (valid) {
+        fflush(stdout);
+        success = CheckMapping(options, NULL, verbose);
+        fflush(stdout);
+      }
+      RestoreStderr(saved_stderr);
+      if (!valid) {
+        char combination[128];
+        snprintf(combination, sizeof(combination), "%smux=%d %s",
+                 invalid_count ? ", " : "", mux, mappers[i].c_str());
+        invalid.append(combination);
+        ++invalid_count;
+      } else if (!success) {
+        ++failures;
+      }
+    }
+  }
+  if (invalid_count > 0) {
+    printf("%d combinations not checked, invalid for these settings: %s\n",
+           invalid_count, invalid.c_str());
+  }
+  printf("%d failing combinations.\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2015 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Measure what it costs per pixel to get colors into the bitplanes of a
+// FrameCanvas: SetPixel(), SetPixels(), and both while the brightness
+// changes, which needs the color lookup of the new brightness.
+// Prints a checksum of the frames drawn, so that builds of the library can
+// be compared for the same output as well as for speed.
+// Does not need any hardware or root.
+//
+// $ make setpixel-benchmark
+// $ ./setpixel-benchmark --led-rows=32 --led-cols=64 --led-chain=2
+
+#include "led-matrix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Options:\n"
+          "\t-n <passes>               : Full canvas passes per run "
+          "(default 50).\n"
+          "\t-r <runs>                 : Runs; the fastest counts "
+          "(default 10).\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// FNV-1a over the bitplanes of "canvas", mixed into "hash".
+static uint32_t HashCanvas(FrameCanvas *canvas, uint32_t hash) {
+  const char *data;
+  size_t len;
+  canvas->Serialize(&data, &len);
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+class Benchmark {
+public:
+  Benchmark(FrameCanvas *canvas, int brightness, int passes, int runs)
+    : canvas_(canvas), brightness_(brightness), passes_(passes), runs_(runs),
+      width_(canvas->width()), height_(canvas->height()),
+      checksum_(2166136261u) {
+    // Random colors, so that the table lookups aren't all the same.
+    // One row more than the canvas, so that each pass starts at another one.
+    rgb_.resize(3 * width_ * (height_ + 1));
+    uint32_t seed = 1;
+    for (size_t i = 0; i < rgb_.size(); ++i) {
+      seed = seed * 1103515245 + 12345;
+      rgb_[i] = seed >> 16;
+    }
+  }
+
+  // Nanoseconds per pixel of the fastest run of the method; also adds the
+  // frame of the last pass to the checksum.
+  double Measure(void (Benchmark::*draw)(int pass), bool vary_brightness) {
+    double best = -1;
+    for (int run = 0; run < runs_; ++run) {
+      const double start = Now();
+      for (int pass = 0; pass < passes_; ++pass) {
+        if (vary_brightness) canvas_->SetBrightness(1 + pass % 100);
+        (this->*draw)(pass);
+      }
+      const double ns = (Now() - start) * 1e9 / passes_ / (width_ * height_);
+      if (best < 0 || ns < best) best = ns;
+    }
+    canvas_->SetBrightness(brightness_);
+    checksum_ = HashCanvas(canvas_, checksum_);
+    return best;
+  }
+
+  void DrawWithSetPixel(int pass) {
+    const uint8_t *rgb = Row(pass);
+    for (int y = 0; y < height_; ++y) {
+      for (int x = 0; x < width_; ++x, rgb += 3) {
+        canvas_->SetPixel(x, y, rgb[0], rgb[1], rgb[2]);
+      }
+    }
+  }
+
+  void DrawWithSetPixels(int pass) {
+    canvas_->SetPixels(0, 0, width_, height_, Row(pass), 3 * width_);
+  }
+
+  uint32_t checksum() const { return checksum_; }
+
+private:
+  const uint8_t *Row(int pass) const {
+    return &rgb_[3 * width_ * (pass % 2)];
+  }
+
+  FrameCanvas *const canvas_;
+  const int brightness_;
+  const int passes_;
+  const int runs_;
+  const int width_;
+  const int height_;
+  std::vector<uint8_t> rgb_;
+  uint32_t checksum_;
+};
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  int passes = 50;
+  int runs = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+    case 'n': passes = atoi(optarg); break;
+    case 'r': runs = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (passes <= 0 || runs <= 0)
+    return usage(argv[0]);
+
+  std::string err;
+  if (!matrix_options.Validate(&err)) {
+    fprintf(stderr, "%s", err.c_str());
+    return 1;
+  }
+
+  RGBMatrix *matrix = new RGBMatrix(NULL, matrix_options);
+  FrameCanvas *canvas = matrix->CreateFrameCanvas();
+  Benchmark benchmark(canvas, matrix_options.brightness, passes, runs);
+
+  printf("%dx%d, brightness %d, %d pwm bits, %d passes, best of %d runs\n",
+         canvas->width(), canvas->height(), matrix_options.brightness,
+         canvas->pwmbits(), passes, runs);
+  printf("  SetPixel:                      %6.2f ns/pixel\n",
+         benchmark.Measure(&Benchmark::DrawWithSetPixel, false));
+  printf("  SetPixels:                     %6.2f ns/pixel\n",
+         benchmark.Measure(&Benchmark::DrawWithSetPixels, false));
+  printf("  SetPixel, brightness changes:  %6.2f ns/pixel\n",
+         benchmark.Measure(&Benchmark::DrawWithSetPixel, true));
+  printf("  SetPixels, brightness changes: %6.2f ns/pixel\n",
+         benchmark.Measure(&Benchmark::DrawWithSetPixels, true));
+  printf("  checksum %08x\n", benchmark.checksum());
+
+  delete matrix;
+  return 0;
+}
@@ -22,12 +22,18 @@ extern "C" {
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <deque>
+
 #include "led-matrix.h"
 #include "content-streamer.h"
+#include "thread.h"
 
 using rgb_matrix::FrameCanvas;
+using rgb_matrix::Mutex;
+using rgb_matrix::MutexLock;
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::StreamWriter;
 using rgb_matrix::StreamIO;
@@ -43,25 +49,203 @@ static void InterruptHandler(int) {
 #  define av_frame_free avcodec_free_frame
 #endif
 
-struct LedPixel {
-  uint8_t r, g, b;
+// Bounded queue between the stages of the playback pipeline. Push() blocks
+// while it is full, Pop() while it is empty. After Close(), nothing blocks
+// anymore and Pop() returns false once the queue is drained.
+template <class T> class PipelineQueue {
+public:
+  PipelineQueue(size_t capacity) : capacity_(capacity), closed_(false) {
+    pthread_cond_init(&changed_, NULL);
+  }
+  ~PipelineQueue() { pthread_cond_destroy(&changed_); }
+
+  void Push(const T &item) {
+    MutexLock l(&mutex_);
+    while (items_.size() >= capacity_ && !closed_)
+      mutex_.WaitOn(&changed_);
+    items_.push_back(item);
+    pthread_cond_broadcast(&changed_);
+  }
+
+  bool Pop(T *item) {
+    MutexLock l(&mutex_);
+    while (items_.empty() && !closed_)
+      mutex_.WaitOn(&changed_);
+    if (items_.empty()) return false;
+    *item = items_.front();
+    items_.pop_front();
+    pthread_cond_broadcast(&changed_);
+    return true;
+  }
+
+  void Close() {
+    MutexLock l(&mutex_);
+    closed_ = true;
+    pthread_cond_broadcast(&changed_);
+  }
+
+private:
+  const size_t capacity_;
+  Mutex mutex_;
+  pthread_cond_t changed_;
+  std::deque<T> items_;
+  bool closed_;
 };
+
 void CopyFrame(AVFrame *pFrame, FrameCanvas *canvas) {
-  // Write pixel data
-  const int height = canvas->height();
-  const int width = canvas->width();
-  for(int y = 0; y < height; ++y) {
-    LedPixel *pix = (LedPixel*) (pFrame->data[0] + y*pFrame->linesize[0]);
-    for(int x = 0; x < width; ++x, ++pix) {
-      canvas->SetPixel(x, y, pix->r, pix->g, pix->b);
+  // The frame is scaled to the canvas size, packed RGB24.
+  canvas->SetPixels(0, 0, canvas->width(), canvas->height(),
+                    pFrame->data[0], pFrame->linesize[0]);
+}
+
+// Frames in flight between the pipeline stages.
+static const int kScaledFrames = 2;
+static const int kCanvases = 3;
+
+// A frame on its way through the pipeline:
+//   decode + scale (main thread) -> convert to bitplanes -> present.
+// Each stage works on the next frame while the following stage still works
+// on the previous one. The number of buffers in flight is bounded by the
+// pools of free RGB frames and FrameCanvases.
+struct PipelineFrame {
+  AVFrame *rgb;          // Scaled frame; NULL once converted.
+  FrameCanvas *canvas;   // Converted frame.
+  int64_t pts_us;        // Presentation time relative to start of video.
+  bool restart;          // First frame after (re-)start: new time base.
+};
+
+// Converts scaled RGB frames to FrameCanvases.
+class ConvertThread : public rgb_matrix::Thread {
+public:
+  ConvertThread(PipelineQueue<PipelineFrame> *scaled,
+                PipelineQueue<AVFrame*> *free_rgb,
+                PipelineQueue<FrameCanvas*> *free_canvases,
+                PipelineQueue<PipelineFrame> *converted)
+    : scaled_(scaled), free_rgb_(free_rgb), free_canvases_(free_canvases),
+      converted_(converted) {}
+
+  virtual void Run() {
+    PipelineFrame frame;
+    while (scaled_->Pop(&frame) && free_canvases_->Pop(&frame.canvas)) {
+      CopyFrame(frame.rgb, frame.canvas);
+      free_rgb_->Push(frame.rgb);
+      frame.rgb = NULL;
+      converted_->Push(frame);
     }
+    // Unblock the stages before and after us.
+    scaled_->Close();
+    free_rgb_->Close();
+    converted_->Close();
+  }
+
+private:
+  PipelineQueue<PipelineFrame> *const scaled_;
+  PipelineQueue<AVFrame*> *const free_rgb_;
+  PipelineQueue<FrameCanvas*> *const free_canvases_;
+  PipelineQueue<PipelineFrame> *const converted_;
+};
+
+// Shows each frame at its presentation time, or writes it to the stream
+// with the time until the next frame as hold time. Frames are queued with
+// their absolute time with RGBMatrix::PresentAt(), so they go on the screen
+// at the first refresh after it. Frames that are more than a frame late are
+// dropped, so that playback keeps in sync with the source instead of
+// drifting.
+class PresentThread : public rgb_matrix::Thread {
+public:
+  PresentThread(RGBMatrix *matrix, StreamWriter *stream_writer,
+                int64_t frame_duration_us,
+                PipelineQueue<PipelineFrame> *converted,
+                PipelineQueue<FrameCanvas*> *free_canvases)
+    : matrix_(matrix), stream_writer_(stream_writer),
+      frame_duration_us_(frame_duration_us),
+      converted_(converted), free_canvases_(free_canvases),
+      shown_(0), dropped_(0), total_late_us_(0), max_late_us_(0) {}
+
+  virtual void Run() {
+    if (stream_writer_) {
+      WriteStream();
+    } else {
+      ShowOnMatrix();
+    }
+    free_canvases_->Close();  // Unblock the converter.
+  }
+
+  long shown() const { return shown_; }
+  long dropped() const { return dropped_; }
+  // How much later than scheduled the shown frames went on the screen.
+  int64_t average_late_us() const {
+    return shown_ > 1 ? total_late_us_ / (shown_ - 1) : 0;
+  }
+  int64_t max_late_us() const { return max_late_us_; }
+
+private:
+  void ShowOnMatrix() {
+    int64_t time_base = 0;
+    int64_t previous_show_at = -1;
+    PipelineFrame frame;
+    while (!interrupt_received && converted_->Pop(&frame)) {
+      const int64_t now = rgb_matrix::GetPresentationClockMicros();
+      if (frame.restart) time_base = now - frame.pts_us;
+      const int64_t show_at = time_base + frame.pts_us;
+      if (show_at - now < -frame_duration_us_) {
+        free_canvases_->Push(frame.canvas);
+        ++dropped_;
+        continue;
+      }
+      // Only one frame in flight: we get the previous one back once this
+      // one is on the screen, together with the time it was shown itself.
+      matrix_->PresentAt(frame.canvas, show_at);
+      int64_t presented_at;
+      free_canvases_->Push(matrix_->AwaitRetiredCanvas(&presented_at));
+      if (previous_show_at >= 0) {
+        const int64_t late_us = presented_at - previous_show_at;
+        total_late_us_ += late_us;
+        if (late_us > max_late_us_) max_late_us_ = late_us;
+      }
+      previous_show_at = show_at;
+      ++shown_;
+    }
+  }
+
+  // The hold time of a frame is only known once the next one arrives.
+  void WriteStream() {
+    PipelineFrame pending, frame;
+    bool have_pending = false;
+    while (!interrupt_received && converted_->Pop(&frame)) {
+      if (have_pending) {
+        const int64_t hold_us = frame.pts_us - pending.pts_us;
+        Write(pending, hold_us > 0 ? hold_us : frame_duration_us_);
+      }
+      pending = frame;
+      have_pending = true;
+    }
+    if (have_pending) Write(pending, frame_duration_us_);
   }
-}
+
+  void Write(const PipelineFrame &frame, int64_t hold_us) {
+    stream_writer_->Stream(*frame.canvas, hold_us);
+    free_canvases_->Push(frame.canvas);
+    ++shown_;
+  }
+
+  RGBMatrix *const matrix_;
+  StreamWriter *const stream_writer_;
+  const int64_t frame_duration_us_;
+  PipelineQueue<PipelineFrame> *const converted_;
+  PipelineQueue<FrameCanvas*> *const free_canvases_;
+  long shown_;
+  long dropped_;
+  int64_t total_late_us_;
+  int64_t max_late_us_;
+};
 
 static int usage(const char *progname) {
   fprintf(stderr, "usage: %s [options] <video>\n", progname);
   fprintf(stderr, "Options:\n"
           "\t-O<streamfile>     : Output to stream-file instead of matrix (don't need to be root).\n"
+          "\t-K<interval>       : With -O: store frames as changes to the previous frame,\n"
+          "\t                     with a full frame every <interval> frames.\n"
           "\t-v                 : verbose.\n"
           "\t-f                 : Loop forever.\n");
 
@@ -81,9 +265,10 @@ int main(int argc, char *argv[]) {
   bool verbose = false;
   bool forever = false;
   int stream_output_fd = -1;
+  int keyframe_interval = 0;
 
   int opt;
-  while ((opt = getopt(argc, argv, "vO:R:Lf")) != -1) {
+  while ((opt = getopt(argc, argv, "vO:K:R:Lf")) != -1) {
     switch (opt) {
     case 'v':
       verbose = true;
@@ -98,6 +283,9 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       break;
+    case 'K':
+      keyframe_interval = atoi(optarg);
+      break;
     case 'L':
       fprintf(stderr, "-L is deprecated. Use\n\t--led-pixel-mapper=\"U-mapper\" --led-chain=4\ninstead.\n");
       return 1;
@@ -124,11 +312,10 @@ int main(int argc, char *argv[]) {
   AVCodecContext    *pCodecCtx = NULL;
   AVCodec           *pCodec = NULL;
   AVFrame           *pFrame = NULL;
-  AVFrame           *pFrameRGB = NULL;
+  AVFrame           *pFrameRGB[kScaledFrames];
   AVPacket          packet;
   int               frameFinished;
   int               numBytes;
-  uint8_t           *buffer = NULL;
   struct SwsContext *sws_ctx = NULL;
 
   const char *movie_file = argv[optind];
@@ -162,7 +349,7 @@ int main(int argc, char *argv[]) {
   StreamWriter *stream_writer = NULL;
   if (stream_output_fd >= 0) {
     stream_io = new rgb_matrix::FileStreamIO(stream_output_fd);
-    stream_writer = new StreamWriter(stream_io);
+    stream_writer = new StreamWriter(stream_io, keyframe_interval);
     if (forever) {
       fprintf(stderr, "-f (forever) doesn't make sense with -O; disabling\n");
       forever = false;
@@ -207,21 +394,33 @@ int main(int argc, char *argv[]) {
   // Allocate video frame
   pFrame=av_frame_alloc();
 
-  // Allocate an AVFrame structure
-  pFrameRGB=av_frame_alloc();
-  if (pFrameRGB==NULL)
-    return -1;
-
-  // Determine required buffer size and allocate buffer
+  // Determine required buffer size
   numBytes=avpicture_get_size(AV_PIX_FMT_RGB24, pCodecCtx->width,
                               pCodecCtx->height);
-  buffer=(uint8_t *)av_malloc(numBytes*sizeof(uint8_t));
 
-  // Assign appropriate parts of buffer to image planes in pFrameRGB
-  // Note that pFrameRGB is an AVFrame, but AVFrame is a superset
-  // of AVPicture
-  avpicture_fill((AVPicture *)pFrameRGB, buffer, AV_PIX_FMT_RGB24,
-                 pCodecCtx->width, pCodecCtx->height);
+  // The RGB frames to scale to, while others are still being converted.
+  PipelineQueue<AVFrame*> free_rgb(kScaledFrames);
+  for (i = 0; i < kScaledFrames; ++i) {
+    // Allocate an AVFrame structure
+    pFrameRGB[i]=av_frame_alloc();
+    if (pFrameRGB[i]==NULL)
+      return -1;
+    uint8_t *buffer=(uint8_t *)av_malloc(numBytes*sizeof(uint8_t));
+
+    // Assign appropriate parts of buffer to image planes in pFrameRGB
+    // Note that pFrameRGB is an AVFrame, but AVFrame is a superset
+    // of AVPicture
+    avpicture_fill((AVPicture *)pFrameRGB[i], buffer, AV_PIX_FMT_RGB24,
+                   pCodecCtx->width, pCodecCtx->height);
+    free_rgb.Push(pFrameRGB[i]);
+  }
+
+  // Canvases to convert to; one more is on the matrix.
+  PipelineQueue<FrameCanvas*> free_canvases(kCanvases);
+  free_canvases.Push(offscreen_canvas);
+  for (i = 1; i < kCanvases; ++i) {
+    free_canvases.Push(matrix->CreateFrameCanvas());
+  }
 
   // initialize SWS context for software scaling
   sws_ctx = sws_getContext(pCodecCtx->width,
@@ -244,12 +443,28 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, InterruptHandler);
 
   const int frame_wait_micros = 1e6 / fps;
+  const double time_base_us =
+    av_q2d(pFormatCtx->streams[videoStream]->time_base) * 1e6;
+
+  PipelineQueue<PipelineFrame> scaled(kScaledFrames);
+  PipelineQueue<PipelineFrame> converted(kCanvases);
+  ConvertThread convert_thread(&scaled, &free_rgb, &free_canvases,
+                               &converted);
+  PresentThread present_thread(matrix, stream_writer, frame_wait_micros,
+                               &converted, &free_canvases);
+  convert_thread.Start();
+  present_thread.Start();
+
+  bool pipeline_open = true;
   do {
     if (forever) {
       av_seek_frame(pFormatCtx, videoStream, 0, AVSEEK_FLAG_ANY);
       avcodec_flush_buffers(pCodecCtx);
     }
-    while (!interrupt_received && av_read_frame(pFormatCtx, &packet) >= 0) {
+    bool restart = true;
+    int64_t pts_us = 0;
+    while (!interrupt_received && pipeline_open
+           && av_read_frame(pFormatCtx, &packet) >= 0) {
       // Is this a packet from the video stream?
       if (packet.stream_index==videoStream) {
         // Decode video frame
@@ -257,26 +472,49 @@ int main(int argc, char *argv[]) {
 
         // Did we get a video frame?
         if (frameFinished) {
-          // Convert the image from its native format to RGB
-          sws_scale(sws_ctx, (uint8_t const * const *)pFrame->data,
-                    pFrame->linesize, 0, pCodecCtx->height,
-                    pFrameRGB->data, pFrameRGB->linesize);
-
-          CopyFrame(pFrameRGB, offscreen_canvas);
-          frame_count++;
-          if (stream_writer) {
-            stream_writer->Stream(*offscreen_canvas, frame_wait_micros);
-          } else {
-            offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas);
+          // Time to show it; if not known, the frame after the previous.
+          const int64_t pts = av_frame_get_best_effort_timestamp(pFrame);
+          if (pts != AV_NOPTS_VALUE) {
+            pts_us = pts * time_base_us;
+          } else if (!restart) {
+            pts_us += frame_wait_micros;
+          }
+
+          PipelineFrame frame;
+          frame.canvas = NULL;
+          frame.pts_us = pts_us;
+          frame.restart = restart;
+          restart = false;
+          pipeline_open = free_rgb.Pop(&frame.rgb);
+          if (pipeline_open) {
+            // Convert the image from its native format to RGB
+            sws_scale(sws_ctx, (uint8_t const * const *)pFrame->data,
+                      pFrame->linesize, 0, pCodecCtx->height,
+                      frame.rgb->data, frame.rgb->linesize);
+            scaled.Push(frame);
+            frame_count++;
           }
         }
-        if (!stream_writer) usleep(frame_wait_micros);
       }
 
       // Free the packet that was allocated by av_read_frame
       av_free_packet(&packet);
     }
-  } while (forever && !interrupt_received);
+  } while (forever && !interrupt_received && pipeline_open);
+
+  // Let the pipeline finish showing what is decoded.
+  scaled.Close();
+  convert_thread.WaitStopped();
+  present_thread.WaitStopped();
+  if (verbose) {
+    fprintf(stderr, "%ld frames shown, %ld dropped as they were late\n",
+            present_thread.shown(), present_thread.dropped());
+    if (stream_writer == NULL) {
+      fprintf(stderr, "Shown %lldus late on average, at most %lldus\n",
+              (long long)present_thread.average_late_us(),
+              (long long)present_thread.max_late_us());
+    }
+  }
 
   if (interrupt_received) {
     // Feedback for Ctrl-C, but most importantly, force a newline
@@ -284,9 +522,11 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Got interrupt. Exiting\n");
   }
 
-  // Free the RGB image
-  av_free(buffer);
-  av_frame_free(&pFrameRGB);
+  // Free the RGB images
+  for (i = 0; i < kScaledFrames; ++i) {
+    av_free(pFrameRGB[i]->data[0]);
+    av_frame_free(&pFrameRGB[i]);
+  }
 
   // Free the YUV frame
   av_frame_free(&pFrame);